@@ -21,7 +21,7 @@
         data                                                                    \
     )
 
-static void getColorMap(uint8_t *colorMap, const uint8_t *pixels, int nPixels, int quality) {
+static void getColorMap(uint8_t *colorMap, const uint8_t *pixels, size_t nPixels, int quality) {
     initnet(pixels, nPixels * 3, quality);
     learn();
     unbiasnet();
@@ -29,8 +29,8 @@ static void getColorMap(uint8_t *colorMap, const uint8_t *pixels, int nPixels, i
     getcolourmap(colorMap);
 }
 
-static void getRasterBits(uint8_t *rasterBits, const uint8_t *pixels, int nPixels) {
-    for (int i = 0; i < nPixels; ++i) {
+static void getRasterBits(uint8_t *rasterBits, const uint8_t *pixels, size_t nPixels) {
+    for (size_t i = 0; i < nPixels; ++i) {
         rasterBits[i] = inxsearch(
                 pixels[i * 3],
                 pixels[i * 3 + 1],
@@ -40,7 +40,7 @@ static void getRasterBits(uint8_t *rasterBits, const uint8_t *pixels, int nPixel
 }
 
 inline void RGB2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
-    for (const uint8_t *dstEnd = dst + width * height * 3; dst < dstEnd; src += 3) {
+    for (const uint8_t *dstEnd = dst + (size_t) width * height * 3; dst < dstEnd; src += 3) {
         *(dst++) = *(src + 2);
         *(dst++) = *(src + 1);
         *(dst++) = *(src);
@@ -48,7 +48,7 @@ inline void RGB2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
 }
 
 inline void BGRA2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
-    for (const uint8_t *dstEnd = dst + width * height * 3; dst < dstEnd; src += 4) {
+    for (const uint8_t *dstEnd = dst + (size_t) width * height * 3; dst < dstEnd; src += 4) {
         *(dst++) = *(src);
         *(dst++) = *(src + 1);
         *(dst++) = *(src + 2);
@@ -56,7 +56,7 @@ inline void BGRA2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
 }
 
 inline void RGBA2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
-    for (const uint8_t *dstEnd = dst + width * height * 3; dst < dstEnd; src += 4) {
+    for (const uint8_t *dstEnd = dst + (size_t) width * height * 3; dst < dstEnd; src += 4) {
         *(dst++) = *(src + 2);
         *(dst++) = *(src + 1);
         *(dst++) = *(src);
@@ -66,7 +66,7 @@ inline void RGBA2BGR(uint8_t *dst, const uint8_t *src, int width, int height) {
 static bool convertToBGR(GifEncoder::PixelFormat format, uint8_t *dst, const uint8_t *src, int width, int height) {
     switch (format) {
         case GifEncoder::PIXEL_FORMAT_BGR:
-            memcpy(dst, src, width * height * 3);
+            memcpy(dst, src, (size_t) width * height * 3);
             break;
         case GifEncoder::PIXEL_FORMAT_RGB:
             RGB2BGR(dst, src, width, height);
@@ -84,7 +84,7 @@ static bool convertToBGR(GifEncoder::PixelFormat format, uint8_t *dst, const uin
 }
 
 bool GifEncoder::open(const std::string &file, int width, int height,
-                      int quality, bool useGlobalColorMap, int16_t loop, int preAllocSize) {
+                      int quality, bool useGlobalColorMap, int16_t loop, size_t preAllocSize) {
     if (m_gifFile != nullptr) {
         return false;
     }
@@ -128,13 +128,24 @@ bool GifEncoder::open(const std::string &file, int width, int height,
 }
 
 bool GifEncoder::push(PixelFormat format, const uint8_t *frame, int width, int height, int delay) {
-    if (m_gifFile == nullptr) {
+    if (frame == nullptr) {
         return false;
     }
 
-    if (frame == nullptr) {
+    auto *pixels = frameBuffer(width, height);
+    if (pixels == nullptr) {
+        return false;
+    }
+    if (!convertToBGR(format, pixels, frame, width, height)) {
         return false;
     }
+    return pushFrameBuffer(width, height, delay);
+}
+
+uint8_t *GifEncoder::frameBuffer(int width, int height) {
+    if (m_gifFile == nullptr) {
+        return nullptr;
+    }
 
     if (m_useGlobalColorMap) {
         if (isFirstFrame()) {
@@ -146,31 +157,39 @@ bool GifEncoder::push(PixelFormat format, const uint8_t *frame, int width, int h
             }
         }
 
-        int needSize = width * height * 3 * (m_frameCount + 1);
+        size_t needSize = (size_t) width * height * 3 * (m_frameCount + 1);
         if (m_allocSize < needSize) {
             m_framePixels = (uint8_t *) realloc(m_framePixels, needSize);
             m_allocSize = needSize;
 //            printf("realloc 1\n");
         }
-        auto *pixels = m_framePixels + width * height * 3 * m_frameCount;
-        convertToBGR(format, pixels, frame, width, height);
-        m_allFrameDelays.push_back(delay);
+        return m_framePixels + (size_t) width * height * 3 * m_frameCount;
     } else {
-        int needSize = width * height * 3;
+        size_t needSize = (size_t) width * height * 3;
         if (m_allocSize < needSize) {
             m_framePixels = (uint8_t *) realloc(m_framePixels, needSize);
             m_allocSize = needSize;
 //            printf("realloc 2\n");
         }
+        return m_framePixels;
+    }
+}
 
+bool GifEncoder::pushFrameBuffer(int width, int height, int delay) {
+    if (m_gifFile == nullptr || m_framePixels == nullptr) {
+        return false;
+    }
+
+    if (m_useGlobalColorMap) {
+        m_allFrameDelays.push_back(delay);
+    } else {
         auto *pixels = m_framePixels;
-        convertToBGR(format, pixels, frame, width, height);
 
         auto *colorMap = GifMakeMapObject(256, nullptr);
-        getColorMap((uint8_t *) colorMap->Colors, pixels, width * height, m_quality);
+        getColorMap((uint8_t *) colorMap->Colors, pixels, (size_t) width * height, m_quality);
 
-        auto *rasterBits = (GifByteType *) malloc(width * height);
-        getRasterBits((uint8_t *) rasterBits, pixels, width * height);
+        auto *rasterBits = (GifByteType *) malloc((size_t) width * height);
+        getRasterBits((uint8_t *) rasterBits, pixels, (size_t) width * height);
 
         encodeFrame(width, height, delay, colorMap, rasterBits);
     }
@@ -190,13 +209,13 @@ bool GifEncoder::close() {
     if (m_useGlobalColorMap) {
         globalColorMap = GifMakeMapObject(256, nullptr);
         getColorMap((uint8_t *) globalColorMap->Colors, m_framePixels,
-                    m_frameWidth * m_frameHeight * m_frameCount, m_quality);
+                    (size_t) m_frameWidth * m_frameHeight * m_frameCount, m_quality);
         m_gifFile->SColorMap = globalColorMap;
 
         for (int i = 0; i < m_frameCount; ++i) {
-            auto *pixels = m_framePixels + m_frameWidth * m_frameHeight * 3 * i;
-            auto *rasterBits = (GifByteType *) malloc(m_frameWidth * m_frameHeight);
-            getRasterBits((uint8_t *) rasterBits, pixels, m_frameWidth * m_frameHeight);
+            auto *pixels = m_framePixels + (size_t) m_frameWidth * m_frameHeight * 3 * i;
+            auto *rasterBits = (GifByteType *) malloc((size_t) m_frameWidth * m_frameHeight);
+            getRasterBits((uint8_t *) rasterBits, pixels, (size_t) m_frameWidth * m_frameHeight);
 
             encodeFrame(m_frameWidth, m_frameHeight, m_allFrameDelays[i], nullptr, rasterBits);
         }
@@ -36,7 +36,7 @@ public:
      * @return
      */
     bool open(const std::string &file, int width, int height,
-              int quality, bool useGlobalColorMap, int16_t loop, int preAllocSize = 0);
+              int quality, bool useGlobalColorMap, int16_t loop, size_t preAllocSize = 0);
 
     /**
      * add frame
@@ -50,6 +50,26 @@ public:
      */
     bool push(PixelFormat format, const uint8_t *frame, int width, int height, int delay);
 
+    /**
+     * get the buffer of the next frame, to be filled with BGR pixels and added with pushFrameBuffer
+     * avoids converting a frame from another buffer
+     *
+     * @param width frame width
+     * @param height frame height
+     * @return buffer of width * height * 3 bytes, nullptr on failure
+     */
+    uint8_t *frameBuffer(int width, int height);
+
+    /**
+     * add the frame filled into frameBuffer
+     *
+     * @param width frame width, same as given to frameBuffer
+     * @param height frame height, same as given to frameBuffer
+     * @param delay delay time 0.01s
+     * @return
+     */
+    bool pushFrameBuffer(int width, int height, int delay);
+
     /**
      * close gif file
      *
@@ -83,7 +103,7 @@ private:
     bool m_useGlobalColorMap = false;
 
     uint8_t *m_framePixels = nullptr;
-    int m_allocSize = 0;
+    size_t m_allocSize = 0;
     std::vector<int> m_allFrameDelays{};
     int m_frameCount = 0;
     int m_frameWidth = -1;
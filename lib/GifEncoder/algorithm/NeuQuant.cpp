@@ -62,7 +62,7 @@ int alphadec;                    /* biased by 10 bits */
    -------------------------- */
 
 static const unsigned char *thepicture;        /* the input image itself */
-static int lengthcount;                /* lengthcount = H*W*3 */
+static size_t lengthcount;             /* lengthcount = H*W*3 */
 
 static int samplefac;                /* sampling factor 1..30 */
 
@@ -84,7 +84,7 @@ int getNetwork(int i, int j) {
 /* Initialise network in range (0,0,0) to (255,255,255) and set parameters
    ----------------------------------------------------------------------- */
 
-void initnet(const unsigned char *thepic, int len, int sample) {
+void initnet(const unsigned char *thepic, size_t len, int sample) {
     int i;
     int *p;
 
@@ -381,7 +381,8 @@ void alterneigh(int rad, int i, int b, int g, int r) {
 
 void learn() {
     int i, j, b, g, r;
-    int radius, rad, alpha, step, delta, samplepixels;
+    int radius, rad, alpha, step;
+    size_t sample, delta, samplepixels;
     const unsigned char *p;
     const unsigned char *lim;
 
@@ -409,8 +410,8 @@ void learn() {
         }
     }
 
-    i = 0;
-    while (i < samplepixels) {
+    sample = 0;
+    while (sample < samplepixels) {
         b = p[0] << netbiasshift;
         g = p[1] << netbiasshift;
         r = p[2] << netbiasshift;
@@ -422,8 +423,8 @@ void learn() {
         p += step;
         if (p >= lim) p -= lengthcount;
 
-        i++;
-        if (i % delta == 0) {
+        sample++;
+        if (sample % delta == 0) {
             alpha -= alpha / alphadec;
             radius -= radius / radiusdec;
             rad = radius >> radiusbiasshift;
@@ -45,7 +45,7 @@ int getNetwork(int i, int j);
 
 /* Initialise network in range (0,0,0) to (255,255,255) and set parameters
    ----------------------------------------------------------------------- */
-void initnet(const unsigned char *thepic, int len, int sample);
+void initnet(const unsigned char *thepic, size_t len, int sample);
 
 /* Unbias network to give byte values 0..255 and record position i to prepare for sort
    ----------------------------------------------------------------------------------- */
@@ -0,0 +1,78 @@
+// Sample depth benchmark
+// Times the tree construction of each error policy on the same generated image with 8-bit samples and with the
+// samples scaled to 16 bits. The images are generated, so every block is read from the pixels (no summed-area
+// tables or min/max index), and both trees should be the same since the errors are on the 8-bit scale
+
+// make bench
+// ./bin/bench_depth
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+#define BENCH_WIDTH 7680
+#define BENCH_HEIGHT 4320
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// 8K image of random rectangles on every scale, with the 8-bit colors scaled to the sample range
+template <typename Sample>
+static BasicImage<Sample> generateImage() {
+    const int scale = (int)SampleTraits<Sample>::scale;
+    BasicImage<Sample> image(BENCH_WIDTH, BENCH_HEIGHT, 128 * scale, 128 * scale, 128 * scale);
+    std::mt19937 random(13523063);
+    for (int size = 2048; size >= 2; size /= 2) {
+        int count = (int)std::min<long long>(200000, 4LL * BENCH_WIDTH * BENCH_HEIGHT / ((long long)size * size * 8));
+        for (int i = 0; i < count; i++) {
+            int row = random() % BENCH_HEIGHT, col = random() % BENCH_WIDTH;
+            int rowEnd = std::min(BENCH_HEIGHT - 1, row + (int)(random() % size));
+            int colEnd = std::min(BENCH_WIDTH - 1, col + (int)(random() % size));
+            Sample r = random() % 256 * scale, g = random() % 256 * scale, b = random() % 256 * scale;
+            image.paintBlockPixel(row, col, rowEnd, colEnd, r, g, b, false);
+        }
+    }
+    return image;
+}
+
+template <typename Sample>
+static double buildTree(const BasicImage<Sample>& image, ErrorMethod method, double threshold, int64_t& nodes) {
+    return milliseconds([&] {
+        ErrorMetrics::dispatch(method, [&](auto policy) {
+            QuadTree<decltype(policy), Sample> tree(image, 4, threshold);
+            tree.divideExhaust();
+            nodes = tree.getNodeCount();
+        });
+    });
+}
+
+int main() {
+    Image image8 = generateImage<Quantum>();
+    Image16 image16 = generateImage<uint16_t>();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "method     8-bit(ms)  16-bit(ms)   ratio     nodes" << std::endl;
+    ErrorMethod methods[] = { VARIANCE, MEAN_ABSOLUTE_DEVIATION, MAX_PIXEL_DIFFERENCE, SSIM, ENTROPY };
+    const char* names[] = { "VARIANCE", "MAD", "MPD", "SSIM", "ENTROPY" };
+    for (int m = 0; m < 5; m++) {
+        double threshold = methods[m] == SSIM ? 0.9 : methods[m] == ENTROPY ? 1 : 10;
+        int64_t nodes[2] = { 0, 0 };
+        double time8 = buildTree(image8, methods[m], threshold, nodes[0]);
+        double time16 = buildTree(image16, methods[m], threshold, nodes[1]);
+        std::cout << std::left << std::setw(11) << names[m] << std::right
+            << std::setw(9) << time8 << std::setw(12) << time16 << std::setw(8) << time16 / time8 << "x"
+            << std::setw(10) << nodes[0] << (nodes[0] != nodes[1] ? "  (mismatch " + std::to_string(nodes[1]) + ")" : "") << std::endl;
+    }
+    return 0;
+}
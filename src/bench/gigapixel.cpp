@@ -0,0 +1,120 @@
+// Gigapixel regression benchmark
+// Builds trees on a generated single plane image of 60000x60000 pixels, past 2^31 pixels, so that the areas, node
+// counts and buffer sizes have to be 64-bit. The trees are built on the generated image, of which every block is read
+// from the pixels, then on the same image saved as a PGM and loaded from the file as Compression does, through the
+// mapping and with the summed-area tables of the methods that read them when they fit. Checks that the image size is
+// not wrapped and that the node count is that of a quadtree (one root plus four per division)
+
+// make bench
+// ./bin/bench_gigapixel [width height]      (defaults to 60000 60000, about 3.6 GB of pixels and as much of disk)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+#define BENCH_WIDTH 60000
+#define BENCH_HEIGHT 60000
+#define BENCH_MIN_BLOCK_AREA 4096
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// Grayscale image of random rectangles on every scale, down to the minimum block size
+static Image generateImage(int width, int height) {
+    Image image(width, height, 1);
+    image.paintBlockPixel(0, 0, height - 1, width - 1, 128, 128, 128, false);
+    std::mt19937 random(13523063);
+    for (int size = 32768; size >= 64; size /= 2) {
+        int count = (int)std::min<long long>(200000, 4LL * width * height / ((long long)size * size * 8));
+        for (int i = 0; i < count; i++) {
+            int row = random() % height, col = random() % width;
+            int rowEnd = std::min(height - 1, row + (int)(random() % size));
+            int colEnd = std::min(width - 1, col + (int)(random() % size));
+            Quantum value = random() % 256;
+            image.paintBlockPixel(row, col, rowEnd, colEnd, value, value, value, false);
+        }
+    }
+    return image;
+}
+
+// Binary PGM of a single plane image, written row by row
+static std::string saveImage(const Image& image) {
+    std::string path = (std::filesystem::temp_directory_path() / "bench_gigapixel.pgm").string();
+    std::ofstream file(path, std::ios::binary);
+    file << "P5\n" << image.getWidth() << " " << image.getHeight() << "\n255\n";
+    for (int row = 0; row < image.getHeight(); row++) {
+        file.write(reinterpret_cast<const char*>(image.getRow(row, Channels::RED)), image.getWidth());
+    }
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    return path;
+}
+
+// Build a tree with each error method and report it
+static void buildTrees(Image& image, const std::string& source) {
+    ErrorMethod methods[] = { VARIANCE, MAX_PIXEL_DIFFERENCE, ENTROPY };
+    const char* names[] = { "VARIANCE", "MPD", "ENTROPY" };
+    for (int m = 0; m < 3; m++) {
+        double threshold = methods[m] == ENTROPY ? 1 : 10;
+        int64_t nodes = 0;
+        int depth = 0;
+        double tables = 0;
+        double time = milliseconds([&] {
+            ErrorMetrics::dispatch(methods[m], [&](auto policy) {
+                typedef decltype(policy) ErrorPolicy;
+                if (source == "file" && (ErrorPolicy::fromMoments || ErrorPolicy::needsDeviation)
+                    && image.getSize() <= SUMMED_AREA_MAX_PIXELS && !image.hasSummedAreaTables()) {
+                    tables = milliseconds([&] { image.buildSummedAreaTables(); });
+                }
+                QuadTree<ErrorPolicy> tree(image, BENCH_MIN_BLOCK_AREA, threshold);
+                tree.divideExhaust();
+                nodes = tree.getNodeCount();
+                depth = tree.getTreeDepth();
+            });
+        });
+        std::cout << std::left << std::setw(11) << source << std::setw(11) << names[m] << std::right
+            << std::setw(9) << time << std::setw(11) << tables << std::setw(12) << nodes << std::setw(7) << depth
+            << (nodes % 4 != 1 ? "  (not a quadtree)" : "") << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 2 ? std::stoi(argv[1]) : BENCH_WIDTH;
+    int height = argc > 2 ? std::stoi(argv[2]) : BENCH_HEIGHT;
+
+    std::cout << std::fixed << std::setprecision(1);
+    Image image(1, 1, 1);
+    double generation = milliseconds([&] { image = generateImage(width, height); });
+    int64_t expectedSize = (int64_t)width * height;
+    std::cout << "Generated " << width << "x" << height << " (" << image.getSize() << " pixels): " << generation << "ms"
+        << (image.getSize() != expectedSize ? "  (size mismatch)" : "") << std::endl;
+
+    std::cout << "source     method     build(ms)  tables(ms)       nodes  depth" << std::endl;
+    buildTrees(image, "generated");
+
+    // The generated pixels are freed before the file is loaded, the mapping is the only copy of the image
+    std::string path = saveImage(image);
+    image = Image(1, 1, 1);
+    double load = milliseconds([&] { image = Image(path); });
+    buildTrees(image, "file");
+    std::cout << "Loaded " << std::filesystem::path(path).filename().string() << " (" << image.getSize() << " pixels): "
+        << load << "ms" << (image.getSize() != expectedSize ? "  (size mismatch)" : "") << std::endl;
+
+    image = Image(1, 1, 1);
+    std::filesystem::remove(path);
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Histogram pyramid benchmark
+// Times the ENTROPY and MAD errors of every block of each quadtree level of a generated 8K image, reading the block
+// histograms from the pixels against taking them from the pyramid, down to blocks of about 16x16 pixels. The
+// pyramid only stores the first HISTOGRAM_PYRAMID_MAX_LEVEL levels, the deeper blocks are read from the pixels
+// either way. Its build time is given apart, it is paid once per tree. Checks that both errors are the same
+
+// make bench
+// ./bin/bench_histogram
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../error.hpp"
+#include "../histogram.hpp"
+#include "../image.hpp"
+
+#define BENCH_WIDTH 7680
+#define BENCH_HEIGHT 4320
+#define BENCH_MIN_BLOCK_SIDE 16
+
+struct Block {
+    int rowStart, colStart, rowEnd, colEnd;
+};
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// 8K image of random rectangles on every scale
+static Image generateImage() {
+    Image image(BENCH_WIDTH, BENCH_HEIGHT);
+    image.paintBlockPixel(0, 0, BENCH_HEIGHT - 1, BENCH_WIDTH - 1, 128, 128, 128, false);
+    std::mt19937 random(13523063);
+    for (int size = 4096; size >= 4; size /= 2) {
+        int count = std::min(100000, 4 * BENCH_WIDTH * BENCH_HEIGHT / (size * size * 8));
+        for (int i = 0; i < count; i++) {
+            int row = random() % BENCH_HEIGHT, col = random() % BENCH_WIDTH;
+            int rowEnd = std::min(BENCH_HEIGHT - 1, row + (int)(random() % size));
+            int colEnd = std::min(BENCH_WIDTH - 1, col + (int)(random() % size));
+            image.paintBlockPixel(row, col, rowEnd, colEnd, random() % 256, random() % 256, random() % 256, false);
+        }
+    }
+    return image;
+}
+
+// Blocks of each level of the quadtree division, every block of a level divided into the next one
+static std::vector<std::vector<Block>> collectLevels(int height, int width) {
+    std::vector<std::vector<Block>> levels = { { { 0, 0, height - 1, width - 1 } } };
+    while (true) {
+        std::vector<Block> next;
+        for (const Block& b : levels.back()) {
+            if (b.rowEnd - b.rowStart + 1 < 2 * BENCH_MIN_BLOCK_SIDE || b.colEnd - b.colStart + 1 < 2 * BENCH_MIN_BLOCK_SIDE) {
+                return levels;
+            }
+            int rowMid = (b.rowStart + b.rowEnd) / 2, colMid = (b.colStart + b.colEnd) / 2;
+            next.push_back({ b.rowStart, b.colStart, rowMid, colMid });
+            next.push_back({ b.rowStart, colMid + 1, rowMid, b.colEnd });
+            next.push_back({ rowMid + 1, b.colStart, b.rowEnd, colMid });
+            next.push_back({ rowMid + 1, colMid + 1, b.rowEnd, b.colEnd });
+        }
+        levels.push_back(next);
+    }
+}
+
+// Error of a block from its RGB histograms
+template <typename ErrorPolicy>
+static double histogramError(const ChannelHistogram* histograms) {
+    return ErrorPolicy::aggregate(ErrorPolicy::channelError(histograms[Channels::RED]),
+        ErrorPolicy::channelError(histograms[Channels::GREEN]), ErrorPolicy::channelError(histograms[Channels::BLUE]));
+}
+
+// Error of a block with its histograms read from the pixels
+template <typename ErrorPolicy>
+static double pixelError(const Image& image, const Block& b) {
+    ChannelHistogram histograms[3];
+    for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+        ChannelHistogram& histogram = histograms[channel];
+        image.forEachBlockSpan(b.rowStart, b.colStart, b.rowEnd, b.colEnd, static_cast<Channels>(channel),
+            [&histogram](const Quantum* pixel, int length) {
+                for (int i = 0; i < length; i++) {
+                    histogram.add(pixel[i]);
+                }
+            });
+    }
+    return histogramError<ErrorPolicy>(histograms);
+}
+
+template <typename ErrorPolicy>
+static void run(const Image& image, const std::vector<std::vector<Block>>& levels, const char* name) {
+    std::unique_ptr<HistogramPyramid> pyramid;
+    double build = milliseconds([&] { pyramid = std::make_unique<HistogramPyramid>(image); });
+
+    double pixelTotal = 0, pyramidTotal = build;
+    for (size_t level = 0; level < levels.size(); level++) {
+        bool stored = (int)level < pyramid->getLevelCount();
+        double pixelChecksum = 0, pyramidChecksum = 0;
+        double pixels = milliseconds([&] {
+            for (const Block& b : levels[level]) pixelChecksum += pixelError<ErrorPolicy>(image, b);
+        });
+        double fromPyramid = pixels;
+        if (stored) {
+            fromPyramid = milliseconds([&] {
+                for (const Block& b : levels[level]) {
+                    pyramidChecksum += histogramError<ErrorPolicy>(pyramid->find(b.rowStart, b.colStart, b.rowEnd, b.colEnd));
+                }
+            });
+        }
+        pixelTotal += pixels;
+        pyramidTotal += fromPyramid;
+
+        std::cout << std::left << std::setw(9) << name << std::right << std::setw(6) << level << std::setw(9) << levels[level].size()
+            << std::setw(12) << pixels;
+        if (stored) {
+            std::cout << std::setw(13) << fromPyramid << (pixelChecksum != pyramidChecksum ? "  (errors differ)" : "");
+        } else {
+            std::cout << std::setw(13) << "pixels";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::left << std::setw(9) << name << std::right << std::setw(15) << "build" << std::setw(12) << "-"
+        << std::setw(13) << build << std::endl;
+    std::cout << std::left << std::setw(9) << name << std::right << std::setw(15) << "total" << std::setw(12) << pixelTotal
+        << std::setw(13) << pyramidTotal << "  (" << pixelTotal / pyramidTotal << "x)" << std::endl;
+}
+
+int main() {
+    Image image = generateImage();
+    std::vector<std::vector<Block>> levels = collectLevels(image.getHeight(), image.getWidth());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "method    level   blocks  pixels(ms)  pyramid(ms)" << std::endl;
+    run<EntropyPolicy>(image, levels, "ENTROPY");
+    run<MeanAbsoluteDeviationPolicy>(image, levels, "MAD");
+    return 0;
+}
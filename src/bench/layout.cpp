@@ -0,0 +1,86 @@
+// Pixel layout benchmark
+// Times the tree construction of each error policy reading the blocks from the row-major CImg planes against
+// the Z-order tiles. Every block is read from the pixels (no summed-area tables, min/max index or histogram
+// shortcuts for the large blocks besides the histogram pyramid)
+
+// make bench
+// ./bin/bench_layout [image ...]      (defaults to a generated 8K image)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <vector>
+#include <string>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+#define BENCH_WIDTH 7680
+#define BENCH_HEIGHT 4320
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// 8K image of random rectangles on every scale so the trees reach full depth in places
+static Image generateImage() {
+    Image image(BENCH_WIDTH, BENCH_HEIGHT, 128, 128, 128);
+    std::mt19937 random(13523063);
+    for (int size = 2048; size >= 2; size /= 2) {
+        int count = (int)std::min<long long>(200000, 4LL * BENCH_WIDTH * BENCH_HEIGHT / ((long long)size * size * 8));
+        for (int i = 0; i < count; i++) {
+            int row = random() % BENCH_HEIGHT, col = random() % BENCH_WIDTH;
+            int rowEnd = std::min(BENCH_HEIGHT - 1, row + (int)(random() % size));
+            int colEnd = std::min(BENCH_WIDTH - 1, col + (int)(random() % size));
+            image.paintBlockPixel(row, col, rowEnd, colEnd, random() % 256, random() % 256, random() % 256, false);
+        }
+    }
+    return image;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        paths.push_back(argv[i]);
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "image                     method     row-major(ms)  morton(ms)  speedup     nodes" << std::endl;
+    for (size_t p = 0; p < std::max<size_t>(1, paths.size()); p++) {
+        Image rowMajor = paths.empty() ? generateImage() : Image(paths[p]);
+        Image tiled(rowMajor);
+        double tiling = milliseconds([&] { tiled.setPixelLayout(MORTON_TILES); });
+        std::string name = paths.empty() ? "generated 8K" : std::filesystem::path(paths[p]).filename().string();
+
+        ErrorMethod methods[] = { VARIANCE, MEAN_ABSOLUTE_DEVIATION, MAX_PIXEL_DIFFERENCE, SSIM, ENTROPY };
+        const char* names[] = { "VARIANCE", "MAD", "MPD", "SSIM", "ENTROPY" };
+        for (int m = 0; m < 5; m++) {
+            double threshold = methods[m] == SSIM ? 0.9 : methods[m] == ENTROPY ? 1 : 10;
+            int64_t nodes[2] = { 0, 0 };
+            double time[2];
+            const Image* images[2] = { &rowMajor, &tiled };
+            for (int layout = 0; layout < 2; layout++) {
+                time[layout] = milliseconds([&] {
+                    ErrorMetrics::dispatch(methods[m], [&](auto policy) {
+                        QuadTree<decltype(policy)> tree(*images[layout], 4, threshold);
+                        tree.divideExhaust();
+                        nodes[layout] = tree.getNodeCount();
+                    });
+                });
+            }
+
+            std::cout << std::left << std::setw(26) << name << std::setw(11) << names[m] << std::right
+                << std::setw(13) << time[0] << std::setw(12) << time[1] << std::setw(8) << time[0] / time[1] << "x"
+                << std::setw(10) << nodes[0] << (nodes[0] != nodes[1] ? "  (mismatch)" : "") << std::endl;
+        }
+        std::cout << "Tiling " << name << ": " << tiling << "ms" << std::endl;
+    }
+    return 0;
+}
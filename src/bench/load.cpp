@@ -0,0 +1,68 @@
+// Uncompressed load benchmark
+// Times reading a PPM, PGM or BMP file through CImg, which is what the loader did until the files were
+// memory-mapped, against loading the Image from the mapping, building the summed-area tables from the file and the
+// planar copy made on the first read of the pixels. Variance and SSIM trees only read the tables, so they never
+// pay for the copy
+
+// make bench
+// ./bin/bench_load [image ...]      (defaults to a generated 8K PPM in the temporary directory)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "../image.hpp"
+
+#define BENCH_WIDTH 7680
+#define BENCH_HEIGHT 4320
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// 8K PPM of random rectangles
+static std::string generateImage() {
+    cimg_library::CImg<Quantum> image(BENCH_WIDTH, BENCH_HEIGHT, 1, 3, 128);
+    std::mt19937 random(13523063);
+    for (int i = 0; i < 20000; i++) {
+        int row = random() % BENCH_HEIGHT, col = random() % BENCH_WIDTH;
+        Quantum color[3] = { (Quantum)(random() % 256), (Quantum)(random() % 256), (Quantum)(random() % 256) };
+        image.draw_rectangle(col, row, col + random() % 256, row + random() % 256, color);
+    }
+    std::string path = (std::filesystem::temp_directory_path() / "bench_load.ppm").string();
+    image.save(path.c_str());
+    return path;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        paths.push_back(generateImage());
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "image                     CImg read(ms)  mapped(ms)  tables(ms)  planes(ms)" << std::endl;
+    for (const std::string& path : paths) {
+        double cimg = milliseconds([&] { cimg_library::CImg<Quantum> image(path.c_str()); });
+        std::unique_ptr<Image> image;
+        double mapped = milliseconds([&] { image = std::make_unique<Image>(path); });
+        double tables = milliseconds([&] { image->buildSummedAreaTables(); });
+        double planes = milliseconds([&] { image->getRow(0, Channels::RED); });
+
+        std::cout << std::left << std::setw(26) << std::filesystem::path(path).filename().string() << std::right
+            << std::setw(13) << cimg << std::setw(12) << mapped << std::setw(12) << tables << std::setw(12) << planes << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+// Node allocation benchmark
+// Times building and destroying full trees on a generated noise image with a zero threshold and a minimum block
+// area of 1, so that every block is divided down to 2x2 pixels and the tree has over a million nodes. Most blocks
+// are small, so the time is mostly spent allocating, visiting and freeing nodes
+
+// make bench
+// ./bin/bench_nodes [width height]      (defaults to 2048 2048, about 1.4 million nodes)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+#define BENCH_WIDTH 2048
+#define BENCH_HEIGHT 2048
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 2 ? std::stoi(argv[1]) : BENCH_WIDTH;
+    int height = argc > 2 ? std::stoi(argv[2]) : BENCH_HEIGHT;
+
+    Image image(width, height);
+    std::mt19937 random(13523063);
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            image.paintBlockPixel(row, col, row, col, random() % 256, random() % 256, random() % 256, false);
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "mode        build(ms)  teardown(ms)       nodes" << std::endl;
+    TreeBuildMode modes[] = { LEVEL_ORDER, BOTTOM_UP, DEPTH_FIRST };
+    const char* names[] = { "LEVEL_ORDER", "BOTTOM_UP", "DEPTH_FIRST" };
+    for (int m = 0; m < 3; m++) {
+        std::unique_ptr<QuadTree<VariancePolicy>> tree;
+        double build = milliseconds([&] {
+            tree = std::make_unique<QuadTree<VariancePolicy>>(image, 1, 0);
+            if (modes[m] == BOTTOM_UP) {
+                tree->divideBottomUp();
+            } else if (modes[m] == DEPTH_FIRST) {
+                tree->divideDepthFirst();
+            } else {
+                tree->divideExhaust();
+            }
+        });
+        int64_t nodes = tree->getNodeCount();
+        double teardown = milliseconds([&] { tree.reset(); });
+        std::cout << std::left << std::setw(11) << names[m] << std::right
+            << std::setw(10) << build << std::setw(14) << teardown << std::setw(12) << nodes << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Parallel build benchmark
+// Times the tree construction of each error policy on a generated 8K image with one thread and with the parallel
+// build on 2, 4, ... threads up to the hardware threads, or the given thread count. The image is generated, so
+// every block is read from the pixels. Checks that every parallel tree has the node count and depth of the serial one
+
+// make bench
+// ./bin/bench_parallel [threads]      (defaults to the hardware threads)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+#define BENCH_WIDTH 7680
+#define BENCH_HEIGHT 4320
+#define BENCH_MIN_BLOCK_AREA 4
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// 8K image of random rectangles on every scale
+static Image generateImage() {
+    Image image(BENCH_WIDTH, BENCH_HEIGHT);
+    image.paintBlockPixel(0, 0, BENCH_HEIGHT - 1, BENCH_WIDTH - 1, 128, 128, 128, false);
+    std::mt19937 random(13523063);
+    for (int size = 4096; size >= 4; size /= 2) {
+        int count = std::min(100000, 4 * BENCH_WIDTH * BENCH_HEIGHT / (size * size * 8));
+        for (int i = 0; i < count; i++) {
+            int row = random() % BENCH_HEIGHT, col = random() % BENCH_WIDTH;
+            int rowEnd = std::min(BENCH_HEIGHT - 1, row + (int)(random() % size));
+            int colEnd = std::min(BENCH_WIDTH - 1, col + (int)(random() % size));
+            image.paintBlockPixel(row, col, rowEnd, colEnd, random() % 256, random() % 256, random() % 256, false);
+        }
+    }
+    return image;
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? std::stoi(argv[1]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts = { 1 };
+    for (int threads = 2; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    if (maxThreads > 1) {
+        threadCounts.push_back(maxThreads);
+    }
+
+    Image image = generateImage();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "method   threads  build(ms)  speed-up       nodes" << std::endl;
+    ErrorMethod methods[] = { VARIANCE, MEAN_ABSOLUTE_DEVIATION, MAX_PIXEL_DIFFERENCE, ENTROPY, SSIM };
+    const char* names[] = { "VARIANCE", "MAD", "MPD", "ENTROPY", "SSIM" };
+    double thresholds[] = { 30, 8, 40, 4, 0.9 };
+    for (int m = 0; m < 5; m++) {
+        double serial = 0;
+        int64_t serialNodes = 0;
+        int serialDepth = 0;
+        for (int threads : threadCounts) {
+            int64_t nodes = 0;
+            int depth = 0;
+            double time = milliseconds([&] {
+                ErrorMetrics::dispatch(methods[m], [&](auto policy) {
+                    QuadTree<decltype(policy)> tree(image, BENCH_MIN_BLOCK_AREA, thresholds[m], false);
+                    if (threads == 1) {
+                        tree.divideDepthFirst();
+                    } else {
+                        tree.divideParallel(threads);
+                    }
+                    nodes = tree.getNodeCount();
+                    depth = tree.getTreeDepth();
+                });
+            });
+            if (threads == 1) {
+                serial = time;
+                serialNodes = nodes;
+                serialDepth = depth;
+            }
+            std::cout << std::left << std::setw(9) << names[m] << std::right << std::setw(7) << threads
+                << std::setw(11) << time << std::setw(10) << serial / time << std::setw(12) << nodes
+                << (nodes != serialNodes || depth != serialDepth ? "  (differs from the serial tree)" : "") << std::endl;
+        }
+    }
+    return 0;
+}
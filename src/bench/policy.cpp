@@ -0,0 +1,147 @@
+// Error policy benchmark
+// Compares evaluating the block errors through the runtime ErrorMethod switches against the compile-time policies,
+// then times the tree construction of each policy
+
+// make bench
+// ./bin/bench_policy [image ...]      (defaults to every image in test/)
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <string>
+
+#include "../error.hpp"
+#include "../image.hpp"
+#include "../quadtree.hpp"
+
+struct Block {
+    int rowStart, colStart, rowEnd, colEnd;
+};
+
+// Blocks of the quadtree division down to the given area, as visited by an exhaustive tree
+static void collectBlocks(int rowStart, int colStart, int rowEnd, int colEnd, int minArea, std::vector<Block>& blocks) {
+    blocks.push_back({ rowStart, colStart, rowEnd, colEnd });
+    if ((rowEnd - rowStart + 1) * (colEnd - colStart + 1) / 4 < minArea || rowEnd == rowStart || colEnd == colStart) {
+        return;
+    }
+    int rowMid = (rowStart + rowEnd) / 2, colMid = (colStart + colEnd) / 2;
+    collectBlocks(rowStart, colStart, rowMid, colMid, minArea, blocks);
+    collectBlocks(rowStart, colMid + 1, rowMid, colEnd, minArea, blocks);
+    collectBlocks(rowMid + 1, colStart, rowEnd, colMid, minArea, blocks);
+    collectBlocks(rowMid + 1, colMid + 1, rowEnd, colEnd, minArea, blocks);
+}
+
+static double milliseconds(const std::function<void()>& f) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// Means of a block for the deviation pass
+static void blockMeans(const Image& image, const Block& b, double means[3]) {
+    double area = (double)(b.rowEnd - b.rowStart + 1) * (b.colEnd - b.colStart + 1);
+    for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+        means[channel] = image.getBlockSum(b.rowStart, b.colStart, b.rowEnd, b.colEnd, static_cast<Channels>(channel)) / area;
+    }
+}
+
+// Block error with a switch on the method for every block and channel
+static double runtimeError(const Image& image, const Block& b, ErrorMethod method, double threshold) {
+    auto rowOf = [&image](int row, int channel) { return image.getRow(row, static_cast<Channels>(channel)); };
+    double means[3];
+    blockMeans(image, b, means);
+    BlockStatistics statistics = ErrorMetrics::calculateBlockStatistics(rowOf, b.rowStart, b.colStart, b.rowEnd, b.colEnd,
+        method == MEAN_ABSOLUTE_DEVIATION ? means : nullptr);
+    double error = ErrorMetrics::calculateError(method,
+        ErrorMetrics::calculateChannelError(method, statistics, Channels::RED),
+        ErrorMetrics::calculateChannelError(method, statistics, Channels::GREEN),
+        ErrorMetrics::calculateChannelError(method, statistics, Channels::BLUE));
+    return ErrorMetrics::belowThreshold(error, threshold, method) ? 0 : error;
+}
+
+// Same block error with the method known at compile time
+template <typename ErrorPolicy>
+static double policyError(const Image& image, const Block& b, double threshold) {
+    auto rowOf = [&image](int row, int channel) { return image.getRow(row, static_cast<Channels>(channel)); };
+    double means[3];
+    if constexpr (ErrorPolicy::needsDeviation) {
+        blockMeans(image, b, means);
+    }
+    BlockStatistics statistics = ErrorMetrics::calculateBlockStatistics(rowOf, b.rowStart, b.colStart, b.rowEnd, b.colEnd,
+        ErrorPolicy::needsDeviation ? means : nullptr);
+    double error = ErrorPolicy::aggregate(
+        ErrorPolicy::channelError(statistics, Channels::RED),
+        ErrorPolicy::channelError(statistics, Channels::GREEN),
+        ErrorPolicy::channelError(statistics, Channels::BLUE));
+    return ErrorPolicy::belowThreshold(error, threshold) ? 0 : error;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        for (const auto& entry : std::filesystem::directory_iterator("test")) {
+            std::string extension = entry.path().extension().string();
+            if (extension == ".png" || extension == ".jpg" || extension == ".jpeg") {
+                paths.push_back(entry.path().string());
+            }
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "image                     method     runtime(ms)  policy(ms)  speedup   tree build(ms)" << std::endl;
+    for (const std::string& path : paths) {
+        Image image(path);
+        // The block means of the runtime and policy errors are read from the tables
+        image.buildSummedAreaTables();
+        std::vector<Block> blocks;
+        collectBlocks(0, 0, image.getHeight() - 1, image.getWidth() - 1, 4, blocks);
+
+        ErrorMethod methods[] = { VARIANCE, MEAN_ABSOLUTE_DEVIATION, MAX_PIXEL_DIFFERENCE, SSIM, ENTROPY };
+        const char* names[] = { "VARIANCE", "MAD", "MPD", "SSIM", "ENTROPY" };
+        for (int m = 0; m < 5; m++) {
+            double threshold = methods[m] == SSIM ? 0.9 : 1;
+            double runtimeChecksum = 0, policyChecksum = 0;
+
+            // Entropy has no fused kernel path to compare
+            double runtime = 0, policy = 0;
+            if (methods[m] != ENTROPY) {
+                runtime = milliseconds([&] {
+                    for (const Block& b : blocks) runtimeChecksum += runtimeError(image, b, methods[m], threshold);
+                });
+                policy = milliseconds([&] {
+                    ErrorMetrics::dispatch(methods[m], [&](auto p) {
+                        if constexpr (decltype(p)::method != ENTROPY) {
+                            for (const Block& b : blocks) policyChecksum += policyError<decltype(p)>(image, b, threshold);
+                        }
+                    });
+                });
+            }
+
+            // Exhaustive tree, SSIM only stops on identical pixels
+            double buildThreshold = methods[m] == SSIM ? 1 : 0;
+            double build = milliseconds([&] {
+                ErrorMetrics::dispatch(methods[m], [&](auto p) {
+                    QuadTree<decltype(p)> tree(image, 1, buildThreshold);
+                    tree.divideExhaust();
+                });
+            });
+
+            std::cout << std::left << std::setw(26) << std::filesystem::path(path).filename().string()
+                << std::setw(11) << names[m] << std::right;
+            if (methods[m] != ENTROPY) {
+                std::cout << std::setw(11) << runtime << std::setw(12) << policy << std::setw(8) << runtime / policy << "x";
+            } else {
+                std::cout << std::setw(11) << "-" << std::setw(12) << "-" << std::setw(9) << "-";
+            }
+            std::cout << std::setw(17) << build << (runtimeChecksum != policyChecksum ? "  (mismatch)" : "") << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "bufferpool.hpp"
+
+BufferPool::BufferPool(size_t capacity) : idleBytes(0), capacity(capacity) {}
+
+BufferPool& BufferPool::global() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = idle.find(size);
+        if (it != idle.end() && !it->second.empty()) {
+            std::unique_ptr<unsigned char[]> bytes = std::move(it->second.back());
+            it->second.pop_back();
+            idleBytes -= size;
+            return Buffer(this, std::move(bytes), size);
+        }
+    }
+    // Nothing to reuse, allocated outside of the lock
+    return Buffer(this, std::unique_ptr<unsigned char[]>(new unsigned char[size]), size);
+}
+
+void BufferPool::give(std::unique_ptr<unsigned char[]> bytes, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size > capacity) {
+        return;     // Freed when bytes goes out of scope
+    }
+    idle[size].push_back(std::move(bytes));
+    idleBytes += size;
+    trim();
+}
+
+void BufferPool::setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->capacity = capacity;
+    trim();
+}
+size_t BufferPool::getCapacity() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return capacity;
+}
+
+size_t BufferPool::getIdleBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idleBytes;
+}
+
+void BufferPool::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.clear();
+    idleBytes = 0;
+}
+
+void BufferPool::trim() {
+    // Free the smallest buffers first, the large ones are the most expensive to allocate again
+    while (idleBytes > capacity) {
+        auto smallest = idle.end();
+        for (auto it = idle.begin(); it != idle.end(); ++it) {
+            if (!it->second.empty() && (smallest == idle.end() || it->first < smallest->first)) {
+                smallest = it;
+            }
+        }
+        smallest->second.pop_back();
+        idleBytes -= smallest->first;
+        if (smallest->second.empty()) {
+            idle.erase(smallest);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define BUFFER_POOL_DEFAULT_CAPACITY ((size_t)256 << 20)    // Bytes of idle buffers kept by default
+
+// Pool of pixel buffers keyed by their size in bytes
+// Buffers returned to the pool are kept for the next request of the same size instead of being freed, as long
+// as the idle buffers stay within the capacity. Repeated images of the same dimensions then reuse the same memory
+class BufferPool {
+public:
+    // Borrowed buffer, returned to its pool when destroyed
+    class Buffer {
+    private:
+        BufferPool* pool;
+        std::unique_ptr<unsigned char[]> bytes;
+        size_t size;
+    public:
+        Buffer() : pool(nullptr), size(0) {}
+        Buffer(BufferPool* pool, std::unique_ptr<unsigned char[]> bytes, size_t size)
+            : pool(pool), bytes(std::move(bytes)), size(size) {}
+        Buffer(Buffer&& other) noexcept : pool(other.pool), bytes(std::move(other.bytes)), size(other.size) { other.size = 0; }
+        Buffer& operator=(Buffer&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool = other.pool;
+                bytes = std::move(other.bytes);
+                size = other.size;
+                other.size = 0;
+            }
+            return *this;
+        }
+        ~Buffer() { release(); }
+
+        unsigned char* data() const { return bytes.get(); }
+        size_t getSize() const { return size; }
+
+        // Return the buffer to its pool early
+        void release() {
+            if (bytes) {
+                pool->give(std::move(bytes), size);
+            }
+            size = 0;
+        }
+    };
+
+    BufferPool(size_t capacity = BUFFER_POOL_DEFAULT_CAPACITY);
+
+    // Pool shared by every Image
+    static BufferPool& global();
+
+    // Borrow an uninitialized buffer of the given size
+    Buffer acquire(size_t size);
+
+    // Bytes of idle buffers the pool may keep. Lowering it frees idle buffers right away
+    void setCapacity(size_t capacity);
+    size_t getCapacity() const;
+
+    // Bytes of the idle buffers currently kept
+    size_t getIdleBytes() const;
+
+    // Free every idle buffer
+    void clear();
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<size_t, std::vector<std::unique_ptr<unsigned char[]>>> idle;
+    size_t idleBytes;
+    size_t capacity;
+
+    // Take back a buffer, freed if it does not fit within the capacity
+    void give(std::unique_ptr<unsigned char[]> bytes, size_t size);
+
+    // Free idle buffers until they fit within the capacity. The mutex must be held
+    void trim();
+};
+
+#endif
@@ -18,9 +18,20 @@ void Compression::validate() {
     if (config.minBlockArea < 1) {
         throw std::invalid_argument("Minimum block area must be at least 1.");
     }
+    if (config.threadCount < 0) {
+        throw std::invalid_argument("Thread count must be greater than or equal to 0.");
+    }
+    if (config.taskMinArea < 1) {
+        throw std::invalid_argument("Task minimum area must be at least 1.");
+    }
     
     try {
-        inputImage = std::make_unique<Image>(config.inputImageAddress);
+        // 16-bit images are compressed with 16-bit samples, every other image with 8-bit samples
+        bitDepth = readBitDepth(config.inputImageAddress);
+        withData([&](auto& data) {
+            typedef typename std::decay_t<decltype(data)>::SampleType Sample;
+            data.inputImage = std::make_unique<BasicImage<Sample>>(config.inputImageAddress);
+        });
         originalSize = calculateFileSize(config.inputImageAddress);
     } catch (const std::exception& e) {
         throw std::runtime_error("Failed to load input image: " + std::string(e.what()));
@@ -42,67 +53,117 @@ void Compression::compress() {
         throw std::runtime_error("Compression not validated. Call validate() first.");
     }
 
-    tree = std::make_unique<QuadTree>(*inputImage, config.minBlockArea, config.errorThreshold, config.errorMethod);
-    tree->divideExhaust();
-    outputImage = std::make_unique<Image>(tree->merge(-1));
+    // Output and GIF frame images borrow their pixels from the pool
+    BufferPool::global().setCapacity(config.bufferPoolCapacity);
+
+    withData([&](auto& data) {
+        typedef typename std::decay_t<decltype(data)>::SampleType Sample;
+        BasicImage<Sample>& inputImage = *data.inputImage;
+        if (inputImage.getPixelLayout() != config.pixelLayout) {
+            inputImage.setPixelLayout(config.pixelLayout);
+        }
+        if (config.errorMethod == MAX_PIXEL_DIFFERENCE && !inputImage.hasRangeIndex()) {
+            // Block min and max without reading the whole block
+            inputImage.buildRangeIndex();
+        }
+        bool readsMoments = ErrorMetrics::dispatch(config.errorMethod, [](auto policy) {
+            return decltype(policy)::fromMoments || decltype(policy)::needsDeviation;
+        });
+        if (readsMoments && inputImage.getSize() <= SUMMED_AREA_MAX_PIXELS && !inputImage.hasSummedAreaTables()) {
+            // Block sums in constant time, only for the methods that read them. The others never pay for the tables
+            inputImage.buildSummedAreaTables();
+        }
+
+        // The only place where the error method is dispatched at runtime, the tree is compiled for each policy
+        // Only merged by depth, so the errors may stop at a bound once a block is known to exceed the threshold
+        data.tree = ErrorMetrics::dispatch(config.errorMethod, [&](auto policy) -> std::unique_ptr<QuadTreeBase<Sample>> {
+            return std::make_unique<QuadTree<decltype(policy), Sample>>(inputImage, config.minBlockArea, config.errorThreshold, false);
+        });
+        if (config.buildMode == PARALLEL) {
+            data.tree->divideParallel(config.threadCount, config.taskMinArea);
+        } else if (config.buildMode == BOTTOM_UP) {
+            data.tree->divideBottomUp();
+        } else if (config.buildMode == DEPTH_FIRST) {
+            data.tree->divideDepthFirst();
+        } else {
+            data.tree->divideExhaust();
+        }
+        data.outputImage = std::make_unique<BasicImage<Sample>>(inputImage.getWidth(), inputImage.getHeight(),
+            inputImage.getPlaneCount());
+        data.tree->mergeInto(*data.outputImage, -1);
+    });
 }
 
 // Finalize the compression process and save the image
 void Compression::save() {
-    if (!outputImage) {
-        throw std::runtime_error("No output image to save. Call compress() first.");
-    }
+    withData([&](auto& data) {
+        if (!data.outputImage) {
+            throw std::runtime_error("No output image to save. Call compress() first.");
+        }
 
-    // Save the compressed image
-    try {
-        outputImage->save(config.outputImageAddress);
-    } catch (const std::exception& e) {
-        throw std::runtime_error("Failed to save output image: " + std::string(e.what()));
-    }
+        // Save the compressed image
+        try {
+            data.outputImage->save(config.outputImageAddress);
+        } catch (const std::exception& e) {
+            throw std::runtime_error("Failed to save output image: " + std::string(e.what()));
+        }
+    });
     compressedSize = calculateFileSize(config.outputImageAddress);
     compressionRatio = calculateCompressionRatio(originalSize, compressedSize);
 }
 
 // Form GIF image that visualizes the compression process
 void Compression::formGIF() {
-    if (!tree) {
+    if (getNodeCount() == 0) {
         throw std::runtime_error("Call compress() first.");
     }
 
     int quality = GIF_QUALITY;      // 66.7% quality. Best quality produce rather gorgeous gifs but takes a lot of time (10 frames require about 1 minute to process)
     bool useGlobalColorMap = false; // Global color map would not look great accross all depths but color quantization is supposedly faster(?)
     int loop = 0;                   // Endless loop
-    int preAllocSize = 0;           // No idea what this parameter would do but it works just fine
+    size_t preAllocSize = 0;        // No idea what this parameter would do but it works just fine
     int delay = GIF_DELAY;         
     int loopDelay = GIF_LOOP_DELAY;
 
-    // Create GIF encoder
-    GifEncoder gifEncoder;
-    if (!gifEncoder.open(config.outputGIFAddress, inputImage->getWidth(), inputImage->getHeight(), quality, useGlobalColorMap, loop, preAllocSize)) {
-        throw std::runtime_error("Failed to open GIF encoder.");
-    }
+    withData([&](auto& data) {
+        typedef typename std::decay_t<decltype(data)>::SampleType Sample;
+        int width = data.inputImage->getWidth(), height = data.inputImage->getHeight();
 
-    for (int i=1;i<=getTreeDepth();i++){
-        // Merge the tree at the current depth and save it as a GIF frame
-        auto gifImage = std::make_unique<Image>(tree->merge(i, false));
-        if (i==getTreeDepth()) {
-            gifImage->pushFrame(gifEncoder, loopDelay); // Last frame has longer delay
-        } else {
-            gifImage->pushFrame(gifEncoder, delay);
+        // Create GIF encoder
+        GifEncoder gifEncoder;
+        if (!gifEncoder.open(config.outputGIFAddress, width, height, quality, useGlobalColorMap, loop, preAllocSize)) {
+            throw std::runtime_error("Failed to open GIF encoder.");
         }
-    }
 
-    if (!gifEncoder.close()) {
-        throw std::runtime_error("Failed to close GIF encoder.");
-    }
+        // Every frame is rendered into the same image
+        BasicImage<Sample> gifImage(width, height, data.inputImage->getPlaneCount());
+        for (int i=1;i<=getTreeDepth();i++){
+            // Merge the tree at the current depth and save it as a GIF frame
+            data.tree->mergeInto(gifImage, i, false);
+            if (i==getTreeDepth()) {
+                gifImage.pushFrame(gifEncoder, loopDelay); // Last frame has longer delay
+            } else {
+                gifImage.pushFrame(gifEncoder, delay);
+            }
+        }
+
+        if (!gifEncoder.close()) {
+            throw std::runtime_error("Failed to close GIF encoder.");
+        }
+    });
 }
 
 // Compression information
 long long Compression::getOriginalSize() const { return originalSize; }
 long long Compression::getCompressedSize() const { return compressedSize; }
 double Compression::getCompressionRatio() const { return compressionRatio; }
-int Compression::getTreeDepth() const { return tree ? tree->getTreeDepth() : 0; }
-int Compression::getNodeCount() const { return tree ? tree->getNodeCount() : 0; }
+int Compression::getTreeDepth() const {
+    return withData([](const auto& data) { return data.tree ? data.tree->getTreeDepth() : 0; });
+}
+int64_t Compression::getNodeCount() const {
+    return withData([](const auto& data) { return data.tree ? data.tree->getNodeCount() : (int64_t)0; });
+}
+int Compression::getBitDepth() const { return bitDepth; }
 
 // Utility methods
 // Calculate compression ratio
@@ -18,15 +18,29 @@ struct CompressionConfig {
     std::string extension=".jpg";           // Target file extension
     double errorThreshold=0.0;              // Error threshold for block division
     double compressionTarget=0.0;           // Compression percentage target (not implemented yet)
-    int minBlockArea=1;                     // Minimum block size for block division (width, height)
+    int64_t minBlockArea=1;                 // Minimum block size for block division (width, height)
     ErrorMethod errorMethod=VARIANCE;       // Error calculation method to be used
+    TreeBuildMode buildMode=LEVEL_ORDER;    // Order in which the tree is constructed, only PARALLEL uses more than one thread
+    int threadCount=0;                      // Threads of the PARALLEL build mode, 0 for one per hardware thread. Ignored by the other modes
+    int64_t taskMinArea=PARALLEL_TASK_MIN_AREA;     // Smallest block built as a task of its own by the PARALLEL build mode
+    PixelLayout pixelLayout=ROW_MAJOR;      // Layout the blocks are read from
+    size_t bufferPoolCapacity=BUFFER_POOL_DEFAULT_CAPACITY;    // Bytes of idle image buffers kept for reuse
+};
+
+// Images and tree of a compression, for one sample type
+template <typename Sample>
+struct CompressionData {
+    typedef Sample SampleType;
+    std::unique_ptr<BasicImage<Sample>> inputImage, outputImage;
+    std::unique_ptr<QuadTreeBase<Sample>> tree;
 };
 
 class Compression {
 private:
-    // Compression data
-    std::unique_ptr<Image> inputImage, outputImage;
-    std::unique_ptr<QuadTree> tree;
+    // Compression data. Only the one matching the bit depth of the input image is used
+    CompressionData<Quantum> data8;
+    CompressionData<uint16_t> data16;
+    int bitDepth;
     long long originalSize, compressedSize;
     double compressionRatio;
 
@@ -34,8 +48,14 @@ private:
     CompressionConfig config;
     bool validated;
 
+    // Call f with the compression data of the bit depth of the input image
+    template <typename Function>
+    auto withData(Function f) { return bitDepth == 16 ? f(data16) : f(data8); }
+    template <typename Function>
+    auto withData(Function f) const { return bitDepth == 16 ? f(data16) : f(data8); }
+
 public:
-    Compression(CompressionConfig conf) : config(conf), validated(false), inputImage(nullptr), outputImage(nullptr), tree(nullptr) {}
+    Compression(CompressionConfig conf) : bitDepth(8), config(conf), validated(false) {}
     ~Compression() {}
 
     // Must be called before calling other methods. Will throw exceptions if the parameters are invalid
@@ -54,7 +74,8 @@ public:
     long long getCompressedSize() const;
     double getCompressionRatio() const;
     int getTreeDepth() const;
-    int getNodeCount() const;
+    int64_t getNodeCount() const;
+    int getBitDepth() const;
 
     // Utility methods
     // Calculate compression ratio
@@ -2,7 +2,14 @@
 #define ERROR_HPP
 
 #include <map>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include "rowkernels.hpp"
 
 enum ErrorMethod {
     VARIANCE = 1,
@@ -12,8 +19,323 @@ enum ErrorMethod {
     SSIM = 5
 };
 
+// Mergeable statistics of the pixels of one channel in a block
+// The moments of a block are the sum of the moments of its subblocks
+struct ChannelMoments {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t squareSum = 0;
+    int min = std::numeric_limits<int>::max();
+    int max = std::numeric_limits<int>::min();
+
+    void add(int value) {
+        count++;
+        sum += value;
+        squareSum += (uint64_t)value * value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+
+    void merge(const ChannelMoments& other) {
+        count += other.count;
+        sum += other.sum;
+        squareSum += other.squareSum;
+        if (other.min < min) min = other.min;
+        if (other.max > max) max = other.max;
+    }
+};
+
+// Statistics of the three RGB channels of a block gathered in one pass
+// Statistics of row bands of the same block can be merged
+struct BlockStatistics {
+    std::array<ChannelMoments, 3> moments;
+
+    // Count and sum of the values above floor(mean), only gathered when the block means are given
+    std::array<double, 3> means = { 0, 0, 0 };
+    std::array<uint64_t, 3> countAbove = { 0, 0, 0 };
+    std::array<uint64_t, 3> sumAbove = { 0, 0, 0 };
+
+    // Σ|x - mean| = Σ_above (x - mean) + Σ_rest (mean - x)
+    double absoluteDeviation(int channel) const {
+        double mean = means[channel];
+        double countRest = (double)(moments[channel].count - countAbove[channel]);
+        double sumRest = (double)(moments[channel].sum - sumAbove[channel]);
+        return ((double)sumAbove[channel] - countAbove[channel] * mean) + (countRest * mean - sumRest);
+    }
+
+    // Merge the statistics of another part of the same block, gathered with the same means
+    void merge(const BlockStatistics& other) {
+        for (int channel = 0; channel < 3; channel++) {
+            moments[channel].merge(other.moments[channel]);
+            countAbove[channel] += other.countAbove[channel];
+            sumAbove[channel] += other.sumAbove[channel];
+        }
+        means = other.means;
+    }
+};
+
+// Flat histogram of the 8-bit pixel values of one channel in a block, 16-bit values are binned by their high byte
+// The histogram of a block is the sum of the histograms of its subblocks
+struct ChannelHistogram {
+    static constexpr int BINS = 256;
+
+    uint64_t count = 0;
+    uint32_t bins[BINS] = {};   // Half the size of 64-bit bins for the pyramid, so blocks are limited to 2^32 pixels
+
+    void add(int value) {
+        bins[value]++;
+        count++;
+    }
+
+    void merge(const ChannelHistogram& other) {
+        for (int i = 0; i < BINS; i++) {
+            bins[i] += other.bins[i];
+        }
+        count += other.count;
+    }
+};
+
+// Error policies
+// Each ErrorMethod as a type, so that the quadtree is compiled for one method at a time and the metric can be inlined
+//  method          : the ErrorMethod of the policy
+//  fromMoments     : the error only depends on the count, sum and sum of squares, so the summed-area tables apply
+//  mergeable       : the error can be derived from ChannelMoments merged from subblocks
+//  fromHistogram   : the error can be derived from a ChannelHistogram
+//  needsDeviation  : the fused kernel has to gather Σ|x - mean|
+// Policies evaluated by the fused kernel also give errorBound, a bound of the error of a whole block from the
+// statistics of part of its rows. It lies between the exact error and the threshold once the block is settled
+// scale is the sample value of one 8-bit step, 257 for 16-bit samples. Errors are given on the 8-bit scale so
+// that a threshold means the same at either bit depth
+
+// Bounds are loosened by this much so that rounding never settles a block the exact error would not
+#define ERROR_BOUND_MARGIN 1e-9
+
+// Shared by the methods whose channel errors are averaged and where a lower error is better
+struct AverageErrorPolicy {
+    static double aggregate(double r, double g, double b) { return (r + g + b) / 3.0; }
+    static bool belowThreshold(double error, double threshold) { return error <= threshold; }
+    static bool validThreshold(double threshold) { return threshold >= 0; }     // Nonegative measure
+};
+
+struct VariancePolicy : AverageErrorPolicy {
+    static constexpr ErrorMethod method = VARIANCE;
+    static constexpr bool fromMoments = true, mergeable = true, fromHistogram = false, needsDeviation = false;
+
+    // n * Σx^2 - (Σx)^2 = n * Σ(x - mean)^2, exact in integers and converted to floating point once
+    static double scaledScatter(uint64_t count, uint64_t sum, uint64_t squareSum) {
+#ifdef __SIZEOF_INT128__
+        return (double)((unsigned __int128)count * squareSum - (unsigned __int128)sum * sum);
+#else
+        long double numerator = (long double)count * squareSum - (long double)sum * sum;
+        return numerator > 0 ? (double)numerator : 0;
+#endif
+    }
+
+    static double variance(uint64_t count, uint64_t sum, uint64_t squareSum) {
+        // By Var(X) = (n * Σx^2 - (Σx)^2) / n^2
+        if (count == 0) {
+            return 0;   // Empty block
+        }
+        return scaledScatter(count, sum, squareSum) / ((double)count * count);
+    }
+    static double channelError(const ChannelMoments& moments, double scale = 1) {
+        // Divided once, so that samples scaled by an exact factor give the same error
+        if (moments.count == 0) {
+            return 0;
+        }
+        return scaledScatter(moments.count, moments.sum, moments.squareSum) / ((double)moments.count * moments.count * scale * scale);
+    }
+    static double channelError(const BlockStatistics& statistics, int channel, double scale = 1) {
+        return channelError(statistics.moments[channel], scale);
+    }
+
+    // Σ(x - mean)^2 of a set of pixels
+    static double scatter(const ChannelMoments& moments) {
+        if (moments.count == 0) {
+            return 0;
+        }
+        return scaledScatter(moments.count, moments.sum, moments.squareSum) / moments.count;
+    }
+
+    // Lower bound of the variance of each channel of a block of count pixels from part of its rows
+    // The scatter of a subset around its own mean never exceeds the scatter of the whole block
+    static std::array<double, 3> varianceBounds(const BlockStatistics& partial, uint64_t count, double scale = 1) {
+        std::array<double, 3> bound;
+        for (int channel = 0; channel < 3; channel++) {
+            bound[channel] = std::max(0.0, scatter(partial.moments[channel]) / count / (scale * scale) - ERROR_BOUND_MARGIN);
+        }
+        return bound;
+    }
+    static double errorBound(const BlockStatistics& partial, uint64_t count, double scale = 1) {
+        std::array<double, 3> bound = varianceBounds(partial, count, scale);
+        return aggregate(bound[0], bound[1], bound[2]);
+    }
+};
+
+struct MeanAbsoluteDeviationPolicy : AverageErrorPolicy {
+    static constexpr ErrorMethod method = MEAN_ABSOLUTE_DEVIATION;
+    static constexpr bool fromMoments = false, mergeable = false, fromHistogram = true, needsDeviation = true;
+
+    // n * Σ|x - mean| = (n * Σ_above x - countAbove * Σx) + (countRest * Σx - n * Σ_rest x), with the values above
+    // floor(mean). Both terms are nonnegative, exact in integers and converted to floating point once like the variance
+    static double meanDeviation(uint64_t count, uint64_t sum, uint64_t countAbove, uint64_t sumAbove, double scale = 1) {
+        if (count == 0) {
+            return 0;   // Empty block
+        }
+#ifdef __SIZEOF_INT128__
+        unsigned __int128 above = (unsigned __int128)count * sumAbove - (unsigned __int128)countAbove * sum;
+        unsigned __int128 rest = (unsigned __int128)(count - countAbove) * sum - (unsigned __int128)count * (sum - sumAbove);
+        double numerator = (double)(above + rest);
+#else
+        long double numerator = (long double)count * sumAbove - (long double)countAbove * sum
+            + (long double)(count - countAbove) * sum - (long double)count * (sum - sumAbove);
+#endif
+        return (double)numerator / ((double)count * count * scale);
+    }
+
+    static double channelError(const BlockStatistics& statistics, int channel, double scale = 1) {
+        // By MAD(X) = E[|X - E[X]|]
+        const ChannelMoments& moments = statistics.moments[channel];
+        return meanDeviation(moments.count, moments.sum, statistics.countAbove[channel], statistics.sumAbove[channel], scale);
+    }
+
+    // Lower bound of the error of a block of count pixels from the statistics of part of its rows
+    // Every pixel adds a nonnegative |x - mean|
+    static double errorBound(const BlockStatistics& partial, uint64_t count, double scale = 1) {
+        double bound[3];
+        for (int channel = 0; channel < 3; channel++) {
+            bound[channel] = std::max(0.0, partial.absoluteDeviation(channel) / count / scale - ERROR_BOUND_MARGIN);
+        }
+        return aggregate(bound[0], bound[1], bound[2]);
+    }
+    static double channelError(const ChannelHistogram& histogram) {
+        // Exact from the histogram in O(bins), split at the pivot floor(E[X]) like the fused kernel
+        if (histogram.count == 0) {
+            return 0;   // Empty block
+        }
+        uint64_t sum = 0;
+        for (int i = 0; i < ChannelHistogram::BINS; i++) {
+            sum += (uint64_t)i * histogram.bins[i];
+        }
+        double mean = (double)sum / histogram.count;
+
+        // Prefix sums up to the pivot
+        int pivot = (int)std::floor(mean);
+        uint64_t countRest = 0, sumRest = 0;
+        for (int i = 0; i <= pivot && i < ChannelHistogram::BINS; i++) {
+            countRest += histogram.bins[i];
+            sumRest += (uint64_t)i * histogram.bins[i];
+        }
+        return meanDeviation(histogram.count, sum, histogram.count - countRest, sum - sumRest);
+    }
+};
+
+struct MaxPixelDifferencePolicy : AverageErrorPolicy {
+    static constexpr ErrorMethod method = MAX_PIXEL_DIFFERENCE;
+    static constexpr bool fromMoments = false, mergeable = true, fromHistogram = false, needsDeviation = false;
+
+    static double channelError(const ChannelMoments& moments, double scale = 1) {
+        // By MaxDiff(X) = max(X) - min(X)
+        return moments.count == 0 ? 0 : (moments.max - moments.min) / scale;
+    }
+    static double channelError(const BlockStatistics& statistics, int channel, double scale = 1) {
+        return channelError(statistics.moments[channel], scale);
+    }
+
+    // Lower bound of the error from part of the rows, the range only widens with more pixels
+    static double errorBound(const BlockStatistics& partial, uint64_t /* count */, double scale = 1) {
+        return aggregate(channelError(partial, 0, scale), channelError(partial, 1, scale), channelError(partial, 2, scale));
+    }
+};
+
+struct EntropyPolicy : AverageErrorPolicy {
+    static constexpr ErrorMethod method = ENTROPY;
+    static constexpr bool fromMoments = false, mergeable = false, fromHistogram = true, needsDeviation = false;
+
+    static double channelError(const ChannelHistogram& histogram) {
+        // By H = -Σ p(x) * log2(p(x)) = log2(n) - Σ f(x) * log2(f(x)) / n
+        if (histogram.count == 0) {
+            return 0;   // Empty block
+        }
+        double sum = 0;
+        for (int i = 0; i < ChannelHistogram::BINS; i++) {
+            sum += frequencyLog2(histogram.bins[i]);
+        }
+        double n = static_cast<double>(histogram.count);
+        double entropy = std::log2(n) - sum / n;
+        return entropy > 0 ? entropy : 0;     // Rounding may leave a tiny negative value
+    }
+
+    // f * log2(f) of a frequency, looked up for the small frequencies that most histogram bins have
+    static double frequencyLog2(uint32_t frequency) {
+        static constexpr uint32_t TABLE_SIZE = 4096;
+        static const std::array<double, TABLE_SIZE> table = [] {
+            std::array<double, TABLE_SIZE> values{};
+            for (uint32_t f = 1; f < TABLE_SIZE; f++) {
+                values[f] = f * std::log2(static_cast<double>(f));
+            }
+            return values;
+        }();
+        if (frequency < TABLE_SIZE) {
+            return table[frequency];
+        }
+        return frequency * std::log2(static_cast<double>(frequency));
+    }
+};
+
+struct SSIMPolicy {
+    static constexpr ErrorMethod method = SSIM;
+    static constexpr bool fromMoments = true, mergeable = true, fromHistogram = false, needsDeviation = false;
+
+    // Value: -1 to 1. Only the variance of the subblock matter
+    static double fromVariance(double var) {
+        // double C1 = 0.0001 * 65025;
+        const double C2 = 0.0009 * 255 * 255;
+
+        // Simplified formula
+        return C2 / (var + C2);
+    }
+    static double channelError(const ChannelMoments& moments, double scale = 1) {
+        return fromVariance(VariancePolicy::channelError(moments, scale));
+    }
+    static double channelError(const BlockStatistics& statistics, int channel, double scale = 1) {
+        return channelError(statistics.moments[channel], scale);
+    }
+
+    // Upper bound of the SSIM from part of the rows, SSIM decreases as the variance grows
+    static double errorBound(const BlockStatistics& partial, uint64_t count, double scale = 1) {
+        std::array<double, 3> variance = VariancePolicy::varianceBounds(partial, count, scale);
+        return aggregate(fromVariance(variance[0]), fromVariance(variance[1]), fromVariance(variance[2])) + ERROR_BOUND_MARGIN;
+    }
+
+    static double aggregate(double r, double g, double b) { return 0.2989 * r + 0.5810 * g + 0.1140 * b; }
+    // For SSIM, we want to check if the error is greater than the threshold
+    // The closer to 1, the more similar/better
+    static bool belowThreshold(double error, double threshold) { return error >= threshold; }
+    static bool validThreshold(double threshold) { return threshold >= -1 && threshold <= 1; }
+};
+
 class ErrorMetrics {
 public:
+    // Call f with the policy of a method. The single point where a runtime ErrorMethod becomes a type
+    template <typename Function>
+    static auto dispatch(ErrorMethod method, Function f) {
+        switch (method) {
+            case VARIANCE:
+                return f(VariancePolicy());
+            case MEAN_ABSOLUTE_DEVIATION:
+                return f(MeanAbsoluteDeviationPolicy());
+            case MAX_PIXEL_DIFFERENCE:
+                return f(MaxPixelDifferencePolicy());
+            case ENTROPY:
+                return f(EntropyPolicy());
+            case SSIM:
+                return f(SSIMPolicy());
+            default:
+                throw std::invalid_argument("Unknown error method.");
+        }
+    }
+
     // Used to calculate the error value of pixels based on various methods
     // Require Iterator object such as the one defined in Image::Iterator
     template <typename Iterator>
@@ -37,52 +359,124 @@ public:
         }
     }
 
+    // Fused statistics kernel. Walks each row of each channel plane of the block once and gathers the
+    // count, sum, sum of squares, min and max, plus Σ|x - mean| for MAD if the channel means are given
+    // rowOf(row, channel) must return a pointer to the first pixel of that row of the channel plane
+    template <typename RowAccessor>
+    static BlockStatistics calculateBlockStatistics(RowAccessor rowOf, int rowStart, int colStart, int rowEnd, int colEnd,
+        const double* means = nullptr) {
+        auto spansOf = [&rowOf](int channel, int rowStart, int colStart, int rowEnd, int colEnd, auto visit) {
+            for (int row = rowStart; row <= rowEnd; row++) {
+                visit(rowOf(row, channel) + colStart, colEnd - colStart + 1);
+            }
+        };
+        return calculateSpanStatistics(spansOf, rowStart, colStart, rowEnd, colEnd, means);
+    }
+
+    // Same kernel over any layout of the block pixels
+    // spansOf(channel, rowStart, colStart, rowEnd, colEnd, visit) must call visit(pixels, length) on contiguous
+    // pieces that together cover the block once. 8-bit and 16-bit pieces go through the vectorized RowKernels of the
+    // current CPU. Only the first channels are read, the others are copies of the first as for single plane images
+    template <typename SpanAccessor>
+    static BlockStatistics calculateSpanStatistics(SpanAccessor spansOf, int rowStart, int colStart, int rowEnd, int colEnd,
+        const double* means = nullptr, int channels = 3) {
+        BlockStatistics statistics;
+        int width = colEnd - colStart + 1;
+        for (int channel = 0; channel < channels; channel++) {
+            ChannelMoments& moments = statistics.moments[channel];
+            moments.count = (uint64_t)(rowEnd - rowStart + 1) * width;
+
+            // Σ|x - mean| is split at the pivot floor(mean) into the values above and the rest, so only
+            // exact integer sums are gathered per pixel
+            long long pivot = means != nullptr ? (long long)std::floor(means[channel]) : 0;
+            uint64_t countAbove = 0, sumAbove = 0;
+
+            const RowKernels& kernels = RowKernels::active();
+            RowReduction reduction;
+            bool reduced = false;   // Only the 8-bit and 16-bit pieces are reduced by the row kernels
+            auto visit = [&](const auto* pixel, int length) {
+                using Sample = std::decay_t<decltype(*pixel)>;
+                if constexpr (std::is_same_v<Sample, uint8_t> || std::is_same_v<Sample, uint16_t>) {
+                    kernels.reduceRow(pixel, length, reduction);
+                    reduced = true;
+                    if (means != nullptr) {
+                        long long maxSample = std::numeric_limits<Sample>::max();
+                        kernels.sumAboveRow(pixel, length, (int)std::max(-1LL, std::min(pivot, maxSample)), countAbove, sumAbove);
+                    }
+                } else {
+                    for (int i = 0; i < length; i++) {
+                        int value = pixel[i];
+                        moments.sum += value;
+                        moments.squareSum += (uint64_t)value * value;
+                        if (value < moments.min) moments.min = value;
+                        if (value > moments.max) moments.max = value;
+                        if (means != nullptr && value > pivot) {
+                            countAbove++;
+                            sumAbove += value;
+                        }
+                    }
+                }
+            };
+            spansOf(channel, rowStart, colStart, rowEnd, colEnd, visit);
+            if (reduced) {
+                moments.sum += reduction.sum;
+                moments.squareSum += reduction.squareSum;
+                moments.min = std::min(moments.min, reduction.min);
+                moments.max = std::max(moments.max, reduction.max);
+            }
+
+            if (means != nullptr) {
+                statistics.means[channel] = means[channel];
+                statistics.countAbove[channel] = countAbove;
+                statistics.sumAbove[channel] = sumAbove;
+            }
+        }
+        for (int channel = channels; channel < 3; channel++) {
+            statistics.moments[channel] = statistics.moments[0];
+            statistics.means[channel] = statistics.means[0];
+            statistics.countAbove[channel] = statistics.countAbove[0];
+            statistics.sumAbove[channel] = statistics.sumAbove[0];
+        }
+        return statistics;
+    }
+
+    // Error value of a channel from the fused block statistics, on the 8-bit scale for samples of the given scale
+    // Valid for every method except ENTROPY. MAD requires the deviation to be gathered
+    static double calculateChannelError(ErrorMethod method, const BlockStatistics& statistics, int channel, double scale = 1) {
+        return dispatch(method, [&](auto policy) {
+            if constexpr (decltype(policy)::method == ENTROPY) {
+                return 0.0;
+            } else {
+                return decltype(policy)::channelError(statistics, channel, scale);
+            }
+        });
+    }
+
+    // Entropy of a block from its histogram
+    static double calculateEntropy(const ChannelHistogram& histogram) {
+        return EntropyPolicy::channelError(histogram);
+    }
+
+    // Exact mean absolute deviation of a block from its histogram in O(bins)
+    static double calculateMeanAbsoluteDeviation(const ChannelHistogram& histogram) {
+        return MeanAbsoluteDeviationPolicy::channelError(histogram);
+    }
+
     // Aggregates the error values of each channel into a single value
     static double calculateError(ErrorMethod method, double r, double g, double b) {
-        switch (method) {
-            case VARIANCE:
-            case MEAN_ABSOLUTE_DEVIATION:
-            case MAX_PIXEL_DIFFERENCE:
-            case ENTROPY:
-                return (r + g + b) / 3.0;
-            case SSIM:
-                return 0.2989 * r + 0.5810 * g + 0.1140 * b;
-            default:
-                return 0;
-        }
+        return dispatch(method, [&](auto policy) { return decltype(policy)::aggregate(r, g, b); });
     }
 
     // Check if the error is within a threshold
     static bool belowThreshold(double error, double threshold, ErrorMethod method) {
-        switch (method) {
-            case VARIANCE:
-            case MEAN_ABSOLUTE_DEVIATION:
-            case MAX_PIXEL_DIFFERENCE:
-            case ENTROPY:
-                return error <= threshold;
-            case SSIM:
-                // For SSIM, we want to check if the error is greater than the threshold
-                // The closer to 1, the more similar/better
-                return error >= threshold;
-            default:
-                return true;
-        }
+        return dispatch(method, [&](auto policy) { return decltype(policy)::belowThreshold(error, threshold); });
     }
 
     static bool validThreshold(double threshold, ErrorMethod method) {
-        switch (method) {
-            case VARIANCE:
-            case MEAN_ABSOLUTE_DEVIATION:
-            case MAX_PIXEL_DIFFERENCE:
-            case ENTROPY:
-                // Nonegative measure
-                return threshold >= 0;
-            case SSIM:
-                // For SSIM, the threshold should be between -1 and 1
-                return threshold >= -1 && threshold <= 1;
-            default:
-                return false;
+        if (method < VARIANCE || method > SSIM) {
+            return false;
         }
+        return dispatch(method, [&](auto policy) { return decltype(policy)::validThreshold(threshold); });
     }
 
 private:
@@ -92,38 +486,29 @@ private:
     template <typename Iterator>
     static double calculateVariance(Iterator begin, Iterator end) {
         // Variance error
-        // By Var(X) = E[(X-E[X])^2]
-        double sum = 0, mean = 0;
-        int count = 0;
-
-        // Calculate mean first
+        // Exact integer sums, only the final division is in floating point
+        uint64_t count = 0, sum = 0, squareSum = 0;
         for (auto it = begin; it != end; ++it) {
-            sum += *it;
+            uint64_t value = *it;
+            sum += value;
+            squareSum += value * value;
             count++;
         }
-        mean = sum / count;
-
-        double variance = 0;
-        for (auto it = begin; it != end; ++it) {
-            variance += std::pow(*it - mean, 2);
-        }
-        return variance / count;
-        
+        return VariancePolicy::variance(count, sum, squareSum);
     }
 
     template <typename Iterator>
     static double calculateMeanAbsoluteDeviation(Iterator begin, Iterator end) {
         // Mean Absolute Deviation error
         // By MAD(X) = E[|X - E[X]|]
-        double sum = 0, mean = 0;
-        int count = 0;
+        uint64_t sum = 0, count = 0;
 
         // Calculate mean first
         for (auto it = begin; it != end; ++it) {
             sum += *it;
             count++;
         }
-        mean = sum / count;
+        double mean = (double)sum / count;
 
         double mad = 0;
         for (auto it = begin; it != end; ++it) {
@@ -150,8 +535,8 @@ private:
         // By H = -Σ p(x) * log2(p(x))
 
         // Calculate frequency of each pixel value for p(x)
-        std::map<typename Iterator::value_type, int> histogram;
-        int count = 0;
+        std::map<typename Iterator::value_type, uint64_t> histogram;
+        uint64_t count = 0;
         for (auto it = begin; it != end; ++it) {
             histogram[*it]++;
             count++;
@@ -170,14 +555,8 @@ private:
     static double calculateSSIM(Iterator begin, Iterator end) {
         // SSIM
         // Value: -1 to 1
-        // double C1 = 0.0001 * 65025;
-        const double C2 = 0.0009 * 255 * 255;
-
         // Only the variance of the subblock matter
-        double var = calculateVariance(begin, end);
-
-        // Simplified formula
-        return C2 / (var + C2);
+        return SSIMPolicy::fromVariance(calculateVariance(begin, end));
     }
 };
 
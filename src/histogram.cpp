@@ -0,0 +1,122 @@
+#include <algorithm>
+#include "histogram.hpp"
+
+template <typename Sample>
+HistogramPyramid::HistogramPyramid(const BasicImage<Sample>& image) {
+    // Split the axes the same way QuadTree divides a block
+    rowIntervals.push_back({ { 0, image.getHeight() - 1 } });
+    colIntervals.push_back({ { 0, image.getWidth() - 1 } });
+    while ((int)rowIntervals.size() <= HISTOGRAM_PYRAMID_MAX_LEVEL) {
+        // A level can only be added if every block of the last level can be divided
+        const std::vector<Interval>& rows = rowIntervals.back();
+        const std::vector<Interval>& cols = colIntervals.back();
+        auto tooShort = [](const Interval& interval) { return interval.end - interval.start < 1; };
+        if (std::any_of(rows.begin(), rows.end(), tooShort) || std::any_of(cols.begin(), cols.end(), tooShort)) {
+            break;
+        }
+
+        std::vector<Interval> nextRows, nextCols;
+        for (const Interval& interval : rows) {
+            int mid = (interval.start + interval.end) / 2;
+            nextRows.push_back({ interval.start, mid });
+            nextRows.push_back({ mid + 1, interval.end });
+        }
+        for (const Interval& interval : cols) {
+            int mid = (interval.start + interval.end) / 2;
+            nextCols.push_back({ interval.start, mid });
+            nextCols.push_back({ mid + 1, interval.end });
+        }
+        rowIntervals.push_back(nextRows);
+        colIntervals.push_back(nextCols);
+    }
+
+    size_t total = 0;
+    for (size_t level = 0; level < rowIntervals.size(); level++) {
+        levelOffset.push_back(total);
+        total += rowIntervals[level].size() * colIntervals[level].size() * 3;
+    }
+    histograms.resize(total);
+
+    // Finest level from the pixels
+    int finest = getLevelCount() - 1;
+    constexpr int shift = SampleTraits<Sample>::bits - 8;
+    const std::vector<Interval>& rows = rowIntervals[finest];
+    const std::vector<Interval>& cols = colIntervals[finest];
+    for (int channel = Channels::RED; channel < image.getPlaneCount(); channel++) {
+        for (size_t i = 0; i < rows.size(); i++) {
+            for (int row = rows[i].start; row <= rows[i].end; row++) {
+                const Sample* pixel = image.getRow(row, static_cast<Channels>(channel));
+                for (size_t j = 0; j < cols.size(); j++) {
+                    uint32_t* bins = histograms[blockIndex(finest, i, j) + channel].bins;
+                    for (int col = cols[j].start; col <= cols[j].end; col++) {
+                        bins[pixel[col] >> shift]++;
+                    }
+                }
+            }
+            for (size_t j = 0; j < cols.size(); j++) {
+                histograms[blockIndex(finest, i, j) + channel].count =
+                    (uint64_t)(rows[i].end - rows[i].start + 1) * (cols[j].end - cols[j].start + 1);
+            }
+        }
+    }
+
+    // Single plane images have the same histograms for every channel
+    for (int channel = image.getPlaneCount(); channel <= Channels::BLUE; channel++) {
+        for (size_t i = 0; i < rows.size(); i++) {
+            for (size_t j = 0; j < cols.size(); j++) {
+                histograms[blockIndex(finest, i, j) + channel] = histograms[blockIndex(finest, i, j)];
+            }
+        }
+    }
+
+    // Coarser levels from their children
+    // Children of block (i, j) are (2i, 2j), (2i, 2j+1), (2i+1, 2j), (2i+1, 2j+1)
+    for (int level = finest - 1; level >= 0; level--) {
+        for (size_t i = 0; i < rowIntervals[level].size(); i++) {
+            for (size_t j = 0; j < colIntervals[level].size(); j++) {
+                size_t parent = blockIndex(level, i, j);
+                for (int child = 0; child < 4; child++) {
+                    size_t index = blockIndex(level + 1, 2 * i + child / 2, 2 * j + child % 2);
+                    for (int channel = 0; channel < 3; channel++) {
+                        histograms[parent + channel].merge(histograms[index + channel]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int HistogramPyramid::getLevelCount() const { return (int)rowIntervals.size(); }
+
+const ChannelHistogram* HistogramPyramid::find(int rowStart, int colStart, int rowEnd, int colEnd) const {
+    // A block's boundaries along an axis appear on a single level since every division shrinks them
+    for (int level = 0; level < getLevelCount(); level++) {
+        int row = findInterval(rowIntervals[level], rowStart, rowEnd);
+        if (row < 0) {
+            continue;
+        }
+        int col = findInterval(colIntervals[level], colStart, colEnd);
+        if (col < 0) {
+            return nullptr;
+        }
+        return &histograms[blockIndex(level, row, col)];
+    }
+    return nullptr;
+}
+
+int HistogramPyramid::findInterval(const std::vector<Interval>& intervals, int start, int end) {
+    auto it = std::lower_bound(intervals.begin(), intervals.end(), start,
+        [](const Interval& interval, int value) { return interval.start < value; });
+    if (it == intervals.end() || it->start != start || it->end != end) {
+        return -1;
+    }
+    return (int)(it - intervals.begin());
+}
+
+size_t HistogramPyramid::blockIndex(int level, int row, int col) const {
+    return levelOffset[level] + ((size_t)row * colIntervals[level].size() + col) * 3;
+}
+
+// Pyramids of each sample type
+template HistogramPyramid::HistogramPyramid(const Image& image);
+template HistogramPyramid::HistogramPyramid(const Image16& image);
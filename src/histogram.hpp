@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <vector>
+#include "image.hpp"
+#include "error.hpp"
+
+// 4^6 blocks on the finest level, about 17 MB of histograms. A further level would take three times the memory of
+// all the levels above it to save a single pass over the pixels, so the deeper blocks are read from the pixels.
+// The first levels, of which every block is evaluated, are where the pyramid pays off, see bench/histogram.cpp
+#define HISTOGRAM_PYRAMID_MAX_LEVEL 6
+
+// Histograms of the blocks of the first levels of the quadtree
+// The blocks are the ones the quadtree division produces, regardless of whether they end up divided.
+// Only the finest level is read from the pixels, every coarser level is the sum of its four children
+// 16-bit samples are binned by their high byte like ChannelHistogram
+class HistogramPyramid {
+private:
+    // Block boundaries of each level along one axis, in division order
+    struct Interval {
+        int start, end;
+    };
+    std::vector<std::vector<Interval>> rowIntervals, colIntervals;
+
+    // RGB histograms of each block. Blocks are stored level by level, row major within a level
+    std::vector<ChannelHistogram> histograms;
+    std::vector<size_t> levelOffset;
+
+    // Index of the interval with the given boundaries on a level, or -1 if there is none
+    static int findInterval(const std::vector<Interval>& intervals, int start, int end);
+
+    // Index of the first of the RGB histograms of a block
+    size_t blockIndex(int level, int row, int col) const;
+
+public:
+    template <typename Sample>
+    HistogramPyramid(const BasicImage<Sample>& image);
+
+    // Number of levels stored
+    int getLevelCount() const;
+
+    // RGB histograms of a quadtree block, stored consecutively
+    // Returns nullptr if the block is deeper than the stored levels
+    const ChannelHistogram* find(int rowStart, int colStart, int rowEnd, int colEnd) const;
+};
+
+#endif
@@ -1,63 +1,370 @@
 #include <stdexcept>
 #include <string>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
 #include "image.hpp"
+#include "mappedimage.hpp"
+#include "rangeindex.hpp"
+#include "rowkernels.hpp"
+
+// Bits per sample of an image file
+int readBitDepth(const std::string& address) {
+    // PNG signature followed by the IHDR chunk, of which the bit depth is the 25th byte of the file
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char header[25];
+    std::ifstream file(address, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        return 8;   // Unreadable files are reported when the image is loaded
+    }
+    if (std::memcmp(header, signature, sizeof(signature)) == 0) {
+        return header[24] == 16 ? 16 : 8;
+    }
+    // Maximum value from the header of the uncompressed formats
+    std::unique_ptr<MappedImage> mapped = MappedImage::open(address);
+    return mapped ? mapped->getBits() : 8;
+}
+
+// Nearest 8-bit value of a 16-bit sample
+static Quantum toQuantum(uint16_t value) {
+    return (Quantum)((value + 128) / 257);
+}
 
 // Constructors and destructors
 // From file
-Image::Image(std::string address) {
-    cimg_library::CImg<Quantum> image(address.c_str());
+template <typename Sample>
+BasicImage<Sample>::BasicImage(std::string address) : layout(ROW_MAJOR), tileColumns(0) {
+    std::unique_ptr<MappedImage> mapped = MappedImage::open(address);
+    if (mapped) {
+        loadMapped(std::move(mapped));
+        return;
+    }
+
+    cimg_library::CImg<Sample> image(address.c_str());
     if (image.is_empty()) {
         throw std::runtime_error("Image not found or empty.");
     }
-    if (image.spectrum() < 3) {
-        throw std::runtime_error("Image do not have at least RGB channels.");
+
+    // Alpha channels are dropped, the output is opaque
+    if (image.spectrum() == 2 || image.spectrum() > 3) {
+        image.channels(0, image.spectrum() == 2 ? 0 : Channels::BLUE);
+    }
+    // RGB with equal channels is as grayscale, only one plane is kept
+    size_t planeSize = (size_t)image.width() * image.height();
+    if (image.spectrum() == 3
+        && std::equal(image.data(), image.data() + planeSize, image.data(0, 0, 0, Channels::GREEN))
+        && std::equal(image.data(), image.data() + planeSize, image.data(0, 0, 0, Channels::BLUE))) {
+        image.channels(0, 0);
     }
 
-    // Image with alpha channel is set to opaque
-    if (image.spectrum() == 4) {
-        image.channel(Channels::ALPHA).fill(1);
+    img.swap(image);
+}
+template <typename Sample>
+void BasicImage<Sample>::loadMapped(std::unique_ptr<MappedImage> file) {
+    int width = file->getWidth(), height = file->getHeight();
+    if constexpr (std::is_same_v<Sample, Quantum>) {
+        if (file->isPlanar()) {
+            // The rows of the file are the plane, shared without copying
+            img.assign(file->getPlane(), width, height, 1, 1, true);
+            mappedFile = std::move(file);
+            return;
+        }
     }
 
-    this->img = image;
+    // Rows are decoded into planar form one at a time
+    std::vector<Sample> rowPixels((size_t)width * 3);
+    Sample* rowPlanes[3] = { rowPixels.data(), rowPixels.data() + width, rowPixels.data() + 2 * (size_t)width };
+
+    // RGB with equal channels is as grayscale, only one plane is kept. Read up to the first pixel that differs
+    int planes = file->getChannels();
+    if (planes == 3) {
+        bool equal = true;
+        for (int row = 0; row < height && equal; row++) {
+            file->readRow(row, rowPlanes);
+            equal = std::equal(rowPlanes[Channels::RED], rowPlanes[Channels::RED] + width, rowPlanes[Channels::GREEN])
+                && std::equal(rowPlanes[Channels::RED], rowPlanes[Channels::RED] + width, rowPlanes[Channels::BLUE]);
+        }
+        planes = equal ? 1 : 3;
+    }
 
+    // Planes are allocated but left unset until copyMappedRows
+    img.assign(width, height, 1, planes);
+    mappedFile = std::move(file);
+    pendingCopy = std::make_unique<std::once_flag>();
+    planesCopied = false;
+}
+template <typename Sample>
+void BasicImage<Sample>::copyMappedRows() const {
+    std::call_once(*pendingCopy, [this] {
+        // Only the pixel values are written, the planes themselves were allocated on load
+        Sample* pixels = const_cast<Sample*>(img.data());
+        size_t width = img.width(), planeSize = width * img.height();
+        // Channels of an RGB file that are not kept as a plane are decoded aside
+        std::vector<Sample> discarded(img.spectrum() < mappedFile->getChannels() ? 2 * width : 0);
+        for (int row = 0; row < img.height(); row++) {
+            Sample* rowPlanes[3] = { pixels + row * width, discarded.data(), discarded.data() + width };
+            for (int channel = Channels::GREEN; channel < img.spectrum(); channel++) {
+                rowPlanes[channel] = pixels + channel * planeSize + row * width;
+            }
+            mappedFile->readRow(row, rowPlanes);
+        }
+        planesCopied = true;
+    });
 }
 // Image object with given dimensions and color
-Image::Image(int width, int height, Quantum r, Quantum g, Quantum b) {
-    cimg_library::CImg<Quantum> image(width, height, 1, 3, 0);  // width, height, depth, channel count, pixel initial value
-    Quantum pixel[3] = { r, g, b };
-    image.draw_rectangle(0, 0, width - 1, height - 1, pixel);
-    
-    this->img = image;
+template <typename Sample>
+BasicImage<Sample>::BasicImage(int width, int height, Sample r, Sample g, Sample b) : layout(ROW_MAJOR), tileColumns(0) {
+    borrowPixels(width, height, 3);
+    Sample pixel[3] = { r, g, b };
+    img.draw_rectangle(0, 0, width - 1, height - 1, pixel);
+}
+// Image object with given dimensions and uninitialized pixels
+template <typename Sample>
+BasicImage<Sample>::BasicImage(int width, int height, int planes) : layout(ROW_MAJOR), tileColumns(0) {
+    if (planes != 1 && planes != 3) {
+        throw std::invalid_argument("Images have 1 or 3 planes.");
+    }
+    borrowPixels(width, height, planes);
 }
 // Copy constructor
-Image::Image(const Image &other) {
+template <typename Sample>
+BasicImage<Sample>::BasicImage(const BasicImage &other) : layout(ROW_MAJOR), tileColumns(0) {
     // Deep copy. Does not share buffer
-    this->img = cimg_library::CImg<Quantum>(other.img, false);
+    other.loadPixels();
+    borrowPixels(other.img.width(), other.img.height(), other.img.spectrum());
+    std::memcpy(img.data(), other.img.data(), img.size() * sizeof(Sample));
+}
+// Move constructor and assignment
+template <typename Sample>
+BasicImage<Sample>::BasicImage(BasicImage &&other) noexcept : layout(ROW_MAJOR), tileColumns(0) {
+    *this = std::move(other);
+}
+template <typename Sample>
+BasicImage<Sample>& BasicImage<Sample>::operator=(BasicImage &&other) noexcept {
+    if (this != &other) {
+        img.swap(other.img);
+        other.img.assign();
+        buffer = std::move(other.buffer);
+        for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+            sumTable[channel] = std::move(other.sumTable[channel]);
+            squareSumTable[channel] = std::move(other.squareSumTable[channel]);
+            tiles[channel] = std::move(other.tiles[channel]);
+        }
+        tileOrder = std::move(other.tileOrder);
+        mappedFile = std::move(other.mappedFile);
+        pendingCopy = std::move(other.pendingCopy);
+        planesCopied = other.planesCopied;
+        layout = other.layout;
+        tileColumns = other.tileColumns;
+        other.layout = ROW_MAJOR;
+        rangeIndex.reset();
+        other.rangeIndex.reset();
+    }
+    return *this;
 }
 
-Image::~Image() { }
+template <typename Sample>
+BasicImage<Sample>::~BasicImage() { }
+
+template <typename Sample>
+void BasicImage<Sample>::borrowPixels(int width, int height, int spectrum) {
+    size_t size = (size_t)width * height * spectrum;
+    buffer = BufferPool::global().acquire(size * sizeof(Sample));
+    // Shared instance, CImg does not free the pixels
+    img.assign((Sample*)buffer.data(), width, height, 1, spectrum, true);    // width, height, depth, channel count
+}
 
 // Dimension getters
-int Image::getSize() const { return img.width() * img.height(); }
-int Image::getWidth() const { return img.width(); }
-int Image::getHeight() const { return img.height(); }
+template <typename Sample>
+int64_t BasicImage<Sample>::getSize() const { return (int64_t)img.width() * img.height(); }
+template <typename Sample>
+int BasicImage<Sample>::getWidth() const { return img.width(); }
+template <typename Sample>
+int BasicImage<Sample>::getHeight() const { return img.height(); }
+template <typename Sample>
+int BasicImage<Sample>::getPlaneCount() const { return img.spectrum(); }
+
+// Row access
+template <typename Sample>
+const Sample* BasicImage<Sample>::getRow(int row, Channels channel) const {
+    if (row < 0 || row >= img.height()) {
+        throw std::out_of_range("Row is out of bounds.");
+    }
+    loadPixels();
+    return img.data(0, row, 0, plane(channel));
+}
+
+// Pixel layout
+template <typename Sample>
+void BasicImage<Sample>::setPixelLayout(PixelLayout layout) {
+    if (layout != ROW_MAJOR && layout != MORTON_TILES) {
+        throw std::invalid_argument("Unknown pixel layout.");
+    }
+    this->layout = layout;
+    if (layout == MORTON_TILES) {
+        buildTiles();
+    } else {
+        for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+            std::vector<Sample>().swap(tiles[channel]);
+        }
+        std::vector<uint32_t>().swap(tileOrder);
+    }
+}
+template <typename Sample>
+PixelLayout BasicImage<Sample>::getPixelLayout() const { return layout; }
+
+template <typename Sample>
+void BasicImage<Sample>::buildTiles() {
+    int width = img.width(), height = img.height();
+    tileColumns = (width + IMAGE_TILE - 1) / IMAGE_TILE;
+    int tileRows = (height + IMAGE_TILE - 1) / IMAGE_TILE;
+
+    // Z-order of the tiles: interleave the bits of the tile row and column, then rank the tiles by that code
+    // Every quadrant of the grid is then a contiguous range of tiles, as are the quadtree blocks down to a tile
+    std::vector<std::pair<uint64_t, uint32_t>> codes;
+    codes.reserve((size_t)tileRows * tileColumns);
+    for (int tileRow = 0; tileRow < tileRows; tileRow++) {
+        for (int tileCol = 0; tileCol < tileColumns; tileCol++) {
+            uint64_t code = 0;
+            for (int bit = 0; bit < 32; bit++) {
+                code |= (uint64_t)((tileCol >> bit) & 1) << (2 * bit);
+                code |= (uint64_t)((tileRow >> bit) & 1) << (2 * bit + 1);
+            }
+            codes.push_back({ code, (uint32_t)(tileRow * tileColumns + tileCol) });
+        }
+    }
+    std::sort(codes.begin(), codes.end());
+    tileOrder.assign(codes.size(), 0);
+    for (size_t rank = 0; rank < codes.size(); rank++) {
+        tileOrder[codes[rank].second] = (uint32_t)rank;
+    }
+
+    size_t tileArea = IMAGE_TILE * IMAGE_TILE;
+    for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+        tiles[channel].assign(codes.size() * tileArea, 0);
+        for (int row = 0; row < height; row++) {
+            const Sample* pixel = getRow(row, static_cast<Channels>(channel));
+            const uint32_t* order = tileOrder.data() + (size_t)(row / IMAGE_TILE) * tileColumns;
+            size_t tileRow = (size_t)(row % IMAGE_TILE) * IMAGE_TILE;
+            for (int col = 0; col < width; col += IMAGE_TILE) {
+                int length = std::min(IMAGE_TILE, width - col);
+                std::copy(pixel + col, pixel + col + length,
+                    tiles[channel].data() + order[col / IMAGE_TILE] * tileArea + tileRow);
+            }
+        }
+    }
+}
+
+// Block statistics
+template <typename Sample>
+bool BasicImage<Sample>::hasSummedAreaTables() const { return !sumTable[Channels::RED].empty(); }
+
+template <typename Sample>
+uint64_t BasicImage<Sample>::getBlockSum(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const {
+    return blockTableSum(sumTable[plane(channel)], rowStart, colStart, rowEnd, colEnd);
+}
+template <typename Sample>
+uint64_t BasicImage<Sample>::getBlockSquareSum(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const {
+    return blockTableSum(squareSumTable[plane(channel)], rowStart, colStart, rowEnd, colEnd);
+}
+
+template <typename Sample>
+uint64_t BasicImage<Sample>::blockTableSum(const std::vector<uint64_t>& table, int rowStart, int colStart, int rowEnd, int colEnd) const {
+    if (table.empty()) {
+        throw std::runtime_error("Summed-area tables are not built for this image.");
+    }
+    if (rowStart < 0 || colStart < 0 || rowEnd >= img.height() || colEnd >= img.width()) {
+        throw std::out_of_range("Coordinates are out of bounds.");
+    }
+    // Inclusion-exclusion over the four corners of the block
+    size_t stride = img.width() + 1;
+    return table[(rowEnd + 1) * stride + (colEnd + 1)] - table[rowStart * stride + (colEnd + 1)]
+        - table[(rowEnd + 1) * stride + colStart] + table[rowStart * stride + colStart];
+}
+
+template <typename Sample>
+void BasicImage<Sample>::buildSummedAreaTables() {
+    if (pendingCopy && !planesCopied) {
+        // Rows of a mapped file are read from the file, the planes are not copied unless the pixels are read
+        std::vector<Sample> rowPixels((size_t)img.width() * 3);
+        Sample* rowPlanes[3] = { rowPixels.data(), rowPixels.data() + img.width(), rowPixels.data() + 2 * (size_t)img.width() };
+        buildSummedAreaTables([&](int row, const Sample** rowPlane) {
+            mappedFile->readRow(row, rowPlanes);
+            for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+                rowPlane[channel] = rowPlanes[channel];
+            }
+        });
+        return;
+    }
+    buildSummedAreaTables([this](int row, const Sample** rowPlanes) {
+        for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+            rowPlanes[channel] = img.data(0, row, 0, channel);
+        }
+    });
+}
+template <typename Sample>
+template <typename ReadRow>
+void BasicImage<Sample>::buildSummedAreaTables(ReadRow readRow) {
+    int width = img.width(), height = img.height();
+    size_t stride = width + 1;
+    for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+        sumTable[channel].assign(stride * (height + 1), 0);
+        squareSumTable[channel].assign(stride * (height + 1), 0);
+    }
+
+    // Each entry is the running sum of its row added to the entry above it
+    for (int row = 0; row < height; row++) {
+        const Sample* rowPlanes[3];
+        readRow(row, rowPlanes);
+        size_t above = row * stride + 1, current = (row + 1) * stride + 1;
+        for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+            uint64_t* sums = sumTable[channel].data();
+            uint64_t* squareSums = squareSumTable[channel].data();
+            const Sample* pixel = rowPlanes[channel];
+            uint64_t rowSum = 0, rowSquareSum = 0;
+            for (int col = 0; col < width; col++) {
+                rowSum += pixel[col];
+                rowSquareSum += (uint64_t)pixel[col] * pixel[col];
+                sums[current + col] = sums[above + col] + rowSum;
+                squareSums[current + col] = squareSums[above + col] + rowSquareSum;
+            }
+        }
+    }
+}
+
+template <typename Sample>
+void BasicImage<Sample>::buildRangeIndex() {
+    rangeIndex = std::make_unique<RangeIndex<Sample>>(*this);
+}
+template <typename Sample>
+bool BasicImage<Sample>::hasRangeIndex() const { return rangeIndex != nullptr; }
+
+template <typename Sample>
+std::pair<int, int> BasicImage<Sample>::getBlockMinMax(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const {
+    if (!rangeIndex) {
+        throw std::runtime_error("Min/max index is not built for this image.");
+    }
+    return rangeIndex->getBlockMinMax(rowStart, colStart, rowEnd, colEnd, channel);
+}
 
 // Pixel setters
-void Image::paintBlockPixel(int rowStart, int colStart, int rowEnd, int colEnd, Quantum r, Quantum g, Quantum b, bool addBorder) {
+template <typename Sample>
+void BasicImage<Sample>::paintBlockPixel(int rowStart, int colStart, int rowEnd, int colEnd, Sample r, Sample g, Sample b, bool addBorder) {
     // Check if the coordinates are within the image bounds
     if (rowStart < 0 || colStart < 0 || rowEnd >= img.height() || colEnd >= img.width()) {
         throw std::out_of_range("Coordinates are out of bounds.");
     }
+    loadPixels();   // The rest of the image keeps the pixels of the file
 
     // Set the pixel values in the specified block
-    Quantum pixel[3] = { r, g, b };
+    Sample pixel[3] = { r, g, b };
     img.draw_rectangle(colStart, rowStart, colEnd, rowEnd, pixel);
 
     // Add border if requested
     if (addBorder) {
         // Thin (1 pixel) black border on top and right side of the block
         // Does not paint border on image border
-        Quantum borderPixel[3] = { 0, 0, 0 }; // Black border
+        Sample borderPixel[3] = { 0, 0, 0 }; // Black border
         if (rowStart != 0) {
             img.draw_rectangle(colStart, rowStart, colEnd, rowStart, borderPixel); // Top border
         }
@@ -67,51 +374,143 @@ void Image::paintBlockPixel(int rowStart, int colStart, int rowEnd, int colEnd,
     }
 }
 
+template <typename Sample>
+void BasicImage<Sample>::fillBlocks(const std::vector<BlockFill>& blocks, bool addBorder) {
+    loadPixels();
+    int width = img.width(), height = img.height();
+    for (const BlockFill& block : blocks) {
+        if (block.rowStart < 0 || block.colStart < 0 || block.rowEnd >= height || block.colEnd >= width
+            || block.rowStart > block.rowEnd || block.colStart > block.colEnd) {
+            throw std::out_of_range("Coordinates are out of bounds.");
+        }
+    }
+
+    // Order the blocks by starting row, then starting column, with two counting sorts
+    // Block indices are size_t, a gigapixel tree may have more leaves than an int holds
+    std::vector<size_t> byColumn(blocks.size()), order(blocks.size());
+    std::vector<size_t> position(std::max(width, height) + 1);
+    auto countingSort = [&](const std::vector<size_t>& input, std::vector<size_t>& output, int range, auto key) {
+        std::fill(position.begin(), position.begin() + range + 1, 0);
+        for (size_t index : input) position[key(blocks[index]) + 1]++;
+        for (int i = 0; i < range; i++) position[i + 1] += position[i];
+        for (size_t index : input) output[position[key(blocks[index])]++] = index;
+    };
+    for (size_t i = 0; i < blocks.size(); i++) order[i] = i;
+    countingSort(order, byColumn, width, [](const BlockFill& block) { return block.colStart; });
+    countingSort(byColumn, order, height, [](const BlockFill& block) { return block.rowStart; });
+
+    // Sweep the rows with the blocks crossing the current row, kept ordered by column
+    std::vector<size_t> active, next;
+    size_t pending = 0;
+    for (int row = 0; row < height; row++) {
+        next.clear();
+        size_t current = 0;
+        while (current < active.size() || (pending < order.size() && blocks[order[pending]].rowStart == row)) {
+            bool fromActive = current < active.size()
+                && (pending >= order.size() || blocks[order[pending]].rowStart != row
+                    || blocks[active[current]].colStart < blocks[order[pending]].colStart);
+            size_t index = fromActive ? active[current++] : order[pending++];
+            if (blocks[index].rowEnd >= row) {
+                next.push_back(index);
+            }
+        }
+        active.swap(next);
+
+        Sample* rowPlanes[3];
+        for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+            rowPlanes[channel] = img.data(0, row, 0, channel);
+        }
+        for (size_t index : active) {
+            const BlockFill& block = blocks[index];
+            int length = block.colEnd - block.colStart + 1;
+            // Thin (1 pixel) black border on top and right side of the block, not on the image border
+            bool topBorder = addBorder && row == block.rowStart && row != 0;
+            bool rightBorder = addBorder && block.colEnd != width - 1;
+            for (int channel = Channels::RED; channel < img.spectrum(); channel++) {
+                std::fill_n(rowPlanes[channel] + block.colStart, length, (Sample)(topBorder ? 0 : block.color[channel]));
+                if (rightBorder) {
+                    rowPlanes[channel][block.colEnd] = 0;
+                }
+            }
+        }
+    }
+}
+
 // Save the image to a file
-void Image::save(std::string address) {
+template <typename Sample>
+void BasicImage<Sample>::save(std::string address) {
+    loadPixels();
+    // Single plane images are expanded to RGB
+    cimg_library::CImg<Sample> expanded;
+    if (img.spectrum() == 1) {
+        expanded.assign(img.width(), img.height(), 1, 3);
+        for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+            std::copy(img.data(), img.data() + img.size(), expanded.data(0, 0, 0, channel));
+        }
+    }
+    const cimg_library::CImg<Sample>& output = img.spectrum() == 1 ? expanded : img;
+
     // Save the image to the specified address
-    img.save(address.c_str());
+    if constexpr (std::is_same_v<Sample, Quantum>) {
+        output.save(address.c_str());
+    } else if (!cimg_library::cimg::strcasecmp(cimg_library::cimg::split_filename(address.c_str()), "png")) {
+        output.save_png(address.c_str(), sizeof(Sample));
+    } else {
+        // Other formats are written with 8 bits per sample
+        cimg_library::CImg<Quantum> rounded(output.width(), output.height(), 1, output.spectrum());
+        for (size_t i = 0; i < output.size(); i++) {
+            rounded[i] = toQuantum(output[i]);
+        }
+        rounded.save(address.c_str());
+    }
 }
 
 // Push image into a GIF frame
-void Image::pushFrame(GifEncoder& gifEncoder, int delay) const {
-    // Transform into interleaved RGB form
+template <typename Sample>
+void BasicImage<Sample>::pushFrame(GifEncoder& gifEncoder, int delay) const {
+    // Transform into interleaved BGR form straight into the frame buffer of the encoder
     // CImg stores data in planar form like so R1R2R3...RnG1G2G3...GnB1B2B3...Bn
-    // GIF encoder requires interleaved format R1G1B1R2G2B2...RnGnBn
-    uint8_t* data = (uint8_t*)malloc(8 * img.width() * img.height() * 3);
+    // GIF encoder takes interleaved format B1G1R1B2G2R2...BnGnRn
+    int width = img.width(), height = img.height();
+    uint8_t* data = gifEncoder.frameBuffer(width, height);
     if (data == nullptr) {
         throw std::runtime_error("Failed to allocate memory for GIF frame.");
     }
-    int pos = 0;
-    for (auto it = beginBlock(0, 0, img.height() - 1, img.width() - 1, Channels::RED);
-            it != endBlock(0, 0, img.height() - 1, img.width() - 1, Channels::RED); ++it) {
-        *(data+pos) = *it;
-        pos += 3;
-    }
-    pos = 1;
-    for (auto it = beginBlock(0, 0, img.height() - 1, img.width() - 1, Channels::GREEN);
-            it != endBlock(0, 0, img.height() - 1, img.width() - 1, Channels::GREEN); ++it) {
-        *(data+pos) = *it;
-        pos += 3;
-    }
-    pos = 2;
-    for (auto it = beginBlock(0, 0, img.height() - 1, img.width() - 1, Channels::BLUE);
-            it != endBlock(0, 0, img.height() - 1, img.width() - 1, Channels::BLUE); ++it) {
-        *(data+pos) = *it;
-        pos += 3;
+    const RowKernels& kernels = RowKernels::active();
+    for (int row = 0; row < height; row++) {
+        const Sample* red = getRow(row, Channels::RED);
+        const Sample* green = getRow(row, Channels::GREEN);
+        const Sample* blue = getRow(row, Channels::BLUE);
+        uint8_t* bgr = data + (size_t)row * width * 3;
+        if constexpr (std::is_same_v<Sample, Quantum>) {
+            kernels.interleaveBGR(red, green, blue, width, bgr);
+        } else {
+            for (int col = 0; col < width; col++) {
+                bgr[3 * col] = toQuantum(blue[col]);
+                bgr[3 * col + 1] = toQuantum(green[col]);
+                bgr[3 * col + 2] = toQuantum(red[col]);
+            }
+        }
     }
 
-    // Immediately transform the data into intermediate buffer so data can be safely freed
-    gifEncoder.push(GifEncoder::PIXEL_FORMAT_RGB, data, img.width(), img.height(), delay);
-    free(data);
+    if (!gifEncoder.pushFrameBuffer(width, height, delay)) {
+        throw std::runtime_error("Failed to push GIF frame.");
+    }
 }
 
 
 /* Iterator */
 // Modifiable iterator
-Image::Iterator Image::beginBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const {
-    return Image::Iterator(img, channel, startRow, startCol, endRow, endCol);
+template <typename Sample>
+typename BasicImage<Sample>::Iterator BasicImage<Sample>::beginBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const {
+    loadPixels();
+    return Iterator(img, static_cast<Channels>(plane(channel)), startRow, startCol, endRow, endCol);
 }
-Image::Iterator Image::endBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const {
-    return Image::Iterator(img, channel, endRow+1, startCol, endRow+1, startCol);
-}
\ No newline at end of file
+template <typename Sample>
+typename BasicImage<Sample>::Iterator BasicImage<Sample>::endBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const {
+    return Iterator(img, static_cast<Channels>(plane(channel)), endRow+1, startCol, endRow+1, startCol);
+}
+
+// Images for each sample type
+template class BasicImage<Quantum>;
+template class BasicImage<uint16_t>;
@@ -9,9 +9,35 @@
 // GIF utility
 #include "GifEncoder.h"
 
+#include "bufferpool.hpp"
+
 #include <stdexcept>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+
+typedef unsigned char Quantum;      // Unit of subpixel value of 8-bit images
+
+// Sample types the images are compiled for, chosen at load from the bit depth of the file
+template <typename Sample>
+struct SampleTraits;
+template <>
+struct SampleTraits<uint8_t> {
+    static constexpr int bits = 8;
+    static constexpr double scale = 1;      // Sample value of one 8-bit step, errors are given on the 8-bit scale
+};
+template <>
+struct SampleTraits<uint16_t> {
+    static constexpr int bits = 16;
+    static constexpr double scale = 257;    // 65535 / 255
+};
 
-typedef unsigned char Quantum;      // Unit of subpixel value
+// Bits per sample of an image file, 16 for 16-bit PNG, PPM and PGM and 8 for every other file
+int readBitDepth(const std::string& address);
 
 // Channel index e.g. index 0 is used to access the red channel of a pixel
 enum Channels {
@@ -21,57 +47,213 @@ enum Channels {
     ALPHA = 3
 };
 
-class Image {
+// Block of a single color, as painted by Image::fillBlocks
+struct BlockFill {
+    int rowStart, colStart;
+    int rowEnd, colEnd;
+    uint16_t color[3];  // RGB, in the sample range of the image
+};
+
+// Internal layout of the pixels read by the quadtree blocks
+enum PixelLayout {
+    ROW_MAJOR = 1,      // CImg planes, each stored row by row
+    MORTON_TILES = 2    // Each plane split into tiles stored in Z-order, row by row inside a tile
+};
+
+// Tile side of the MORTON_TILES layout. A tile row is a cache line and a tile is about a page for the 3 channels
+#define IMAGE_TILE 32
+
+// Largest image the summed-area tables are built for, 1 GB of tables per plane. Larger images are read from the pixels
+#define SUMMED_AREA_MAX_PIXELS ((int64_t)1 << 26)
+
+template <typename Sample>
+class RangeIndex;
+class MappedImage;
+
+// Planar RGB image of 8-bit or 16-bit samples
+template <typename Sample>
+class BasicImage {
 private:
     // Image object
-    cimg_library::CImg<Quantum> img;
+    cimg_library::CImg<Sample> img;
+
+    // Pixels borrowed from the buffer pool, which img is a shared view of
+    // Empty when img owns its pixels, as for images loaded from a file
+    BufferPool::Buffer buffer;
+
+    // Point img at a buffer borrowed from the pool
+    void borrowPixels(int width, int height, int spectrum);
+
+    // Plane storing a channel. The RGB channels of a single plane image are all stored in its one plane
+    int plane(Channels channel) const { return img.spectrum() == 1 ? 0 : channel; }
+
+    // Uncompressed file the image was loaded from, see MappedImage
+    // Its rows are only copied into the planes on the first read of the pixels, the summed-area tables are built
+    // from the file until then. Images only read through the tables never copy them. The plane of an 8-bit PGM is
+    // the mapping itself
+    std::unique_ptr<MappedImage> mappedFile;
+    std::unique_ptr<std::once_flag> pendingCopy;    // Set when the planes are copied from mappedFile on first read
+    mutable bool planesCopied = false;
+
+    // Load the image from a mapped file instead of CImg
+    void loadMapped(std::unique_ptr<MappedImage> file);
+    // Make sure the planes hold the pixels before they are read or painted. Safe to call from concurrent readers
+    void loadPixels() const {
+        if (pendingCopy) {
+            copyMappedRows();
+        }
+    }
+    void copyMappedRows() const;
+
+    // Summed-area tables of the RGB channels, only built on request
+    // Each table is (width+1) x (height+1), entry (r, c) holds the sum over rows [0, r) and columns [0, c)
+    // Indexed by plane like the tiles below
+    std::vector<uint64_t> sumTable[3];
+    std::vector<uint64_t> squareSumTable[3];
+
+    // Min/max index of the RGB channels, only built on request
+    std::unique_ptr<RangeIndex<Sample>> rangeIndex;
+
+    // Tiled copy of the RGB planes for the MORTON_TILES layout
+    // Tiles are IMAGE_TILE x IMAGE_TILE, the ones on the right and bottom edges are padded
+    PixelLayout layout;
+    std::vector<Sample> tiles[3];
+    std::vector<uint32_t> tileOrder;    // Position in the plane of each tile, indexed row-major by tile row and column
+    int tileColumns;
+
+    // Build the tiled planes from the current pixel values
+    void buildTiles();
+
+    // Build the summed-area tables from rows given by readRow(int row, const Sample** planes), which points planes
+    // at the pixels of the row in each plane
+    template <typename ReadRow>
+    void buildSummedAreaTables(ReadRow readRow);
+
+    // Sum of a block from a summed-area table
+    uint64_t blockTableSum(const std::vector<uint64_t>& table, int rowStart, int colStart, int rowEnd, int colEnd) const;
 public:
     // Constructors and destructors
-    // From file
-    Image(std::string address);
+    // From file. 16-bit files loaded into 8-bit images are truncated, see readBitDepth
+    // Grayscale files and RGB files of which the three channels are equal are kept as a single plane
+    // Binary PPM and PGM and uncompressed BMP files are memory-mapped instead of read by CImg, see mappedFile
+    BasicImage(std::string address);
     // Image object with given dimensions and color
-    Image(int width, int height, Quantum r, Quantum g, Quantum b);
-    // Copy constructor
-    Image(const Image &other);
-    ~Image();
+    BasicImage(int width, int height, Sample r, Sample g, Sample b);
+    // Image object with given dimensions and uninitialized pixels, to be painted over entirely
+    // The pixels of these images and of copies are borrowed from BufferPool::global()
+    BasicImage(int width, int height, int planes = 3);
+    // Copy constructor. Only copies the pixels, the summed-area tables, the min/max index and the tiled layout are not carried over
+    BasicImage(const BasicImage &other);
+    // Move constructor and assignment. Take the pixels and tables without copying, the min/max index which refers
+    // to the image it was built on is not carried over
+    BasicImage(BasicImage &&other) noexcept;
+    BasicImage& operator=(BasicImage &&other) noexcept;
+    ~BasicImage();
     
     // Dimension getters
-    int getSize() const;
+    int64_t getSize() const;
     int getWidth() const;
     int getHeight() const;
+    // Planes stored, 3 for RGB or 1 for a single plane read by all of the RGB channels
+    int getPlaneCount() const;
+
+    // Read-only pointer to the first pixel of a row of a channel. Pixels of a row are contiguous
+    // Hot loops read the pixels through rows or forEachBlockSpan, bounds are only checked once per row
+    const Sample* getRow(int row, Channels channel) const;
+
+    // Layout read by forEachBlockSpan. The tiled copy is made from the current pixels and not updated when the
+    // pixels are painted afterwards, the row and span getters above always read the CImg planes
+    void setPixelLayout(PixelLayout layout);
+    PixelLayout getPixelLayout() const;
+
+    // Calls visit(const Sample* pixels, int length) on contiguous pieces that together cover a block of a channel
+    // once, in no particular order. One piece per row on ROW_MAJOR. On MORTON_TILES one piece per tile the block
+    // covers the full width of, and one per row of the tiles it only partly covers
+    template <typename Visit>
+    void forEachBlockSpan(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel, Visit visit) const {
+        if (rowStart < 0 || colStart < 0 || rowEnd >= img.height() || colEnd >= img.width()) {
+            throw std::out_of_range("Coordinates are out of bounds.");
+        }
+        if (layout == ROW_MAJOR) {
+            loadPixels();
+            const Sample* pixel = img.data(colStart, rowStart, 0, plane(channel));
+            for (int row = rowStart; row <= rowEnd; row++, pixel += img.width()) {
+                visit(pixel, colEnd - colStart + 1);
+            }
+            return;
+        }
+        const Sample* planeTiles = tiles[plane(channel)].data();
+        for (int tileRow = rowStart / IMAGE_TILE; tileRow <= rowEnd / IMAGE_TILE; tileRow++) {
+            int first = std::max(rowStart - tileRow * IMAGE_TILE, 0);
+            int last = std::min(rowEnd - tileRow * IMAGE_TILE, IMAGE_TILE - 1);
+            const uint32_t* order = tileOrder.data() + (size_t)tileRow * tileColumns;
+            for (int tileCol = colStart / IMAGE_TILE; tileCol <= colEnd / IMAGE_TILE; tileCol++) {
+                int left = std::max(colStart - tileCol * IMAGE_TILE, 0);
+                int right = std::min(colEnd - tileCol * IMAGE_TILE, IMAGE_TILE - 1);
+                const Sample* tile = planeTiles + (size_t)order[tileCol] * (IMAGE_TILE * IMAGE_TILE);
+                if (left == 0 && right == IMAGE_TILE - 1) {
+                    // Full tile rows are contiguous
+                    visit(tile + first * IMAGE_TILE, (last - first + 1) * IMAGE_TILE);
+                } else {
+                    for (int row = first; row <= last; row++) {
+                        visit(tile + row * IMAGE_TILE + left, right - left + 1);
+                    }
+                }
+            }
+        }
+    }
+
+    // Block statistics in constant time from the summed-area tables
+    // The tables must be built first, they take 16 bytes per pixel and plane. They are built from the current pixel
+    // values and not updated when the pixels are painted afterwards
+    void buildSummedAreaTables();
+    bool hasSummedAreaTables() const;
+    uint64_t getBlockSum(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const;
+    uint64_t getBlockSquareSum(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const;
+
+    // Block min and max in near constant time from the min/max index
+    // The index must be built first. It is not updated when the pixels are painted afterwards
+    void buildRangeIndex();
+    bool hasRangeIndex() const;
+    std::pair<int, int> getBlockMinMax(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const;
 
     // Pixel setters
-    void paintBlockPixel(int rowStart, int colStart, int rowEnd, int colEnd, Quantum r, Quantum g, Quantum b, bool addBorder);
+    void paintBlockPixel(int rowStart, int colStart, int rowEnd, int colEnd, Sample r, Sample g, Sample b, bool addBorder);
+    // Paint many blocks that do not overlap, each as paintBlockPixel would
+    // Each plane is filled row by row from top to bottom in a single pass instead of block by block
+    void fillBlocks(const std::vector<BlockFill>& blocks, bool addBorder);
 
-    // Save the image to a file
+    // Save the image to a file, single plane images as RGB
+    // 16-bit images keep their depth in PNG and are rounded to 8 bits in other formats
     void save(std::string address);
 
-    // Push image into a GIF frame
+    // Push image into a GIF frame, rounded to 8 bits
     void pushFrame(GifEncoder& gifEncoder, int delay) const;
     
-    // For accessing pixel values
+    // Checked per-pixel access, kept as a debug adapter over a block e.g. for ErrorMetrics::calculateChannelError
+    // Every dereference is bounds checked, use getRow or forEachBlockSpan in loops over the pixels
     class Iterator {
     private:
-        const cimg_library::CImg<Quantum>& img;
+        const cimg_library::CImg<Sample>& img;
         Channels channel;
         int startRow, startCol;
         int endRow, endCol;
         int currentRow, currentCol;
     public:
         // Read only iterator
-        Iterator(const cimg_library::CImg<Quantum>& imgref, Channels channel,
+        Iterator(const cimg_library::CImg<Sample>& imgref, Channels channel,
             int startRow, int startCol,
             int endRow, int endCol)
             : img(imgref), channel(channel), startRow(startRow), startCol(startCol),
             endRow(endRow), endCol(endCol), currentRow(startRow), currentCol(startCol) { };
         
         // Iterator traits
-        using value_type = Quantum;
+        using value_type = Sample;
         using iterator_category = std::input_iterator_tag;
         
         // Accessor methods
         // Read-only
-        Quantum operator*() const {
+        Sample operator*() const {
             if (currentRow < startRow || currentRow > endRow || currentCol < startCol || currentCol > endCol) {
                 throw std::out_of_range("Iterator out of bounds.");
             }
@@ -94,9 +276,12 @@ public:
         bool operator!=(const Iterator &other) const { return !(*this == other); }
     };
 
-    // Use these methods to iterate over a channel of an image subblock, as to be used with the error calculation and QuadTree formation
+    // Use these methods to iterate over a channel of an image subblock, as to be used to check the error calculation
     Iterator beginBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const;
     Iterator endBlock(int startRow, int startCol, int endRow, int endCol, Channels channel) const;
 };
 
+typedef BasicImage<Quantum> Image;      // 8 bits per sample
+typedef BasicImage<uint16_t> Image16;   // 16 bits per sample
+
 #endif
\ No newline at end of file
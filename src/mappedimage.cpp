@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <type_traits>
+#include "mappedimage.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Little-endian fields of the BMP headers
+static uint32_t readLE32(const unsigned char* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+static uint16_t readLE16(const unsigned char* bytes) {
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+MappedImage::MappedImage()
+    : mapping(nullptr), mappingSize(0), pixels(nullptr), rowStride(0), width(0), height(0),
+    channels(0), bytesPerPixel(0), bits(8), bgr(false) {}
+
+MappedImage::~MappedImage() {
+    if (mapping == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, mappingSize);
+#endif
+}
+
+std::unique_ptr<MappedImage> MappedImage::open(const std::string& address) {
+    std::unique_ptr<MappedImage> image(new MappedImage());
+    if (!image->map(address)) {
+        return nullptr;
+    }
+    if (!image->parsePortable() && !image->parseBitmap()) {
+        return nullptr;
+    }
+    return image;
+}
+
+// Map the whole file, copy-on-write
+bool MappedImage::map(const std::string& address) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(address.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+        CloseHandle(file);
+        return false;
+    }
+    // The view keeps the file and the mapping object open, their handles can be closed right away
+    HANDLE mappingHandle = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mappingHandle == nullptr) {
+        return false;
+    }
+    void* view = MapViewOfFile(mappingHandle, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mappingHandle);
+    if (view == nullptr) {
+        return false;
+    }
+    mapping = view;
+    mappingSize = (size_t)size.QuadPart;
+#else
+    int file = ::open(address.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size <= 0) {
+        close(file);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);   // The mapping keeps the file open
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    // The rows are mostly read once from top to bottom, when the statistics are built and when the planes are copied
+    madvise(view, (size_t)status.st_size, MADV_SEQUENTIAL);
+    mapping = view;
+    mappingSize = (size_t)status.st_size;
+#endif
+    return true;
+}
+
+// Binary PPM and PGM: magic number, width, height and maximum value separated by whitespace or comments,
+// then a single whitespace character and the rows of pixels
+bool MappedImage::parsePortable() {
+    const unsigned char* data = static_cast<const unsigned char*>(mapping);
+    if (mappingSize < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        return false;
+    }
+    size_t position = 2;
+    long long values[3];
+    for (int i = 0; i < 3; i++) {
+        while (position < mappingSize && (std::isspace(data[position]) || data[position] == '#')) {
+            if (data[position] == '#') {
+                while (position < mappingSize && data[position] != '\n') {
+                    position++;
+                }
+            } else {
+                position++;
+            }
+        }
+        if (position >= mappingSize || !std::isdigit(data[position])) {
+            return false;
+        }
+        values[i] = 0;
+        while (position < mappingSize && std::isdigit(data[position]) && values[i] <= INT_MAX) {
+            values[i] = values[i] * 10 + (data[position++] - '0');
+        }
+    }
+    if (position >= mappingSize || !std::isspace(data[position])) {
+        return false;
+    }
+    position++;
+
+    // Other maximum values are scaled by CImg
+    if (values[0] < 1 || values[0] > INT_MAX || values[1] < 1 || values[1] > INT_MAX
+        || (values[2] != 255 && values[2] != 65535)) {
+        return false;
+    }
+    width = (int)values[0];
+    height = (int)values[1];
+    channels = data[1] == '6' ? 3 : 1;
+    bits = values[2] == 255 ? 8 : 16;
+    bytesPerPixel = channels * bits / 8;
+    rowStride = (ptrdiff_t)width * bytesPerPixel;
+    if ((mappingSize - position) / (size_t)rowStride < (size_t)height) {
+        return false;   // Truncated file
+    }
+    pixels = data + position;
+    bgr = false;
+    return true;
+}
+
+// Uncompressed BMP with a BITMAPINFOHEADER or later: rows padded to 4 bytes, bottom-up unless the height is negative
+bool MappedImage::parseBitmap() {
+    const unsigned char* data = static_cast<const unsigned char*>(mapping);
+    if (mappingSize < 54 || data[0] != 'B' || data[1] != 'M') {
+        return false;
+    }
+    uint32_t offset = readLE32(data + 10);
+    uint32_t headerSize = readLE32(data + 14);
+    int32_t fileWidth = (int32_t)readLE32(data + 18);
+    int32_t fileHeight = (int32_t)readLE32(data + 22);
+    uint16_t bitCount = readLE16(data + 28);
+    uint32_t compression = readLE32(data + 30);
+    // Palettes, bit fields and compressed rows are left to CImg
+    if (headerSize < 40 || compression != 0 || (bitCount != 24 && bitCount != 32)
+        || fileWidth < 1 || fileHeight == 0 || fileHeight == INT32_MIN) {
+        return false;
+    }
+
+    width = fileWidth;
+    height = fileHeight < 0 ? -fileHeight : fileHeight;
+    channels = 3;
+    bits = 8;
+    bytesPerPixel = bitCount / 8;
+    size_t stride = ((size_t)width * bitCount + 31) / 32 * 4;
+    if (offset > mappingSize || (mappingSize - offset) / stride < (size_t)height) {
+        return false;   // Truncated file
+    }
+    if (fileHeight > 0) {
+        pixels = data + offset + (size_t)(height - 1) * stride;
+        rowStride = -(ptrdiff_t)stride;
+    } else {
+        pixels = data + offset;
+        rowStride = (ptrdiff_t)stride;
+    }
+    bgr = true;
+    return true;
+}
+
+template <typename Sample>
+void MappedImage::readRow(int row, Sample* const* planes) const {
+    const unsigned char* pixel = getRow(row);
+    if (bits == 8) {
+        if (channels == 1) {
+            std::copy(pixel, pixel + width, planes[0]);
+            return;
+        }
+        Sample* red = planes[0];
+        Sample* green = planes[1];
+        Sample* blue = planes[2];
+        int redByte = bgr ? 2 : 0, blueByte = bgr ? 0 : 2;
+        for (int col = 0; col < width; col++, pixel += bytesPerPixel) {
+            red[col] = pixel[redByte];
+            green[col] = pixel[1];
+            blue[col] = pixel[blueByte];
+        }
+        return;
+    }
+    // 16-bit samples are big-endian
+    constexpr int shift = std::is_same_v<Sample, uint8_t> ? 8 : 0;
+    for (int channel = 0; channel < channels; channel++) {
+        Sample* plane = planes[channel];
+        const unsigned char* sample = pixel + 2 * channel;
+        for (int col = 0; col < width; col++, sample += bytesPerPixel) {
+            plane[col] = (Sample)(((sample[0] << 8) | sample[1]) >> shift);
+        }
+    }
+}
+
+template void MappedImage::readRow<uint8_t>(int, uint8_t* const*) const;
+template void MappedImage::readRow<uint16_t>(int, uint16_t* const*) const;
@@ -0,0 +1,59 @@
+#ifndef MAPPEDIMAGE_HPP
+#define MAPPEDIMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Uncompressed image file mapped into memory
+// Binary PPM (P6), PGM (P5) with a maximum value of 255 or 65535, and uncompressed 24-bit or 32-bit BMP are read
+// in place from the mapping, row by row, instead of being loaded by CImg into a temporary first
+// The mapping is private: pixels written through it are copied on write and never reach the file
+class MappedImage {
+private:
+    void* mapping;
+    size_t mappingSize;
+
+    // Pixel data, rows are rowStride bytes apart and may be stored bottom-up
+    const unsigned char* pixels;
+    ptrdiff_t rowStride;
+    int width, height;
+    int channels;       // 1 for PGM, 3 for PPM and BMP
+    int bytesPerPixel;
+    int bits;           // 8 or 16, 16-bit samples are big-endian
+    bool bgr;           // BMP stores its channels in BGR order
+
+    MappedImage();
+    bool map(const std::string& address);
+    bool parsePortable();
+    bool parseBitmap();
+
+public:
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+    ~MappedImage();
+
+    // Map a file, nullptr when it is not one of the formats above or cannot be read, so the caller can fall back to CImg
+    static std::unique_ptr<MappedImage> open(const std::string& address);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+    int getBits() const { return bits; }
+
+    // Bytes of a top-down row of pixels
+    const unsigned char* getRow(int row) const { return pixels + row * rowStride; }
+
+    // Single plane rows that can be read as they are, without decoding: 8-bit PGM
+    // The plane is then the pixel data itself, with width bytes per row
+    bool isPlanar() const { return channels == 1 && bits == 8; }
+    unsigned char* getPlane() const { return const_cast<unsigned char*>(pixels); }
+
+    // Decode a row into one array of width samples per channel, planes[channel] for the channels of the file
+    // 16-bit samples read into 8-bit arrays keep their high byte
+    template <typename Sample>
+    void readRow(int row, Sample* const* planes) const;
+};
+
+#endif
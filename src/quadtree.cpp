@@ -1,84 +1,256 @@
 #include "quadtree.hpp"
 #include "image.hpp"
+#include "taskpool.hpp"
 
 /* QuadTreeNode */
-QuadTreeNode::QuadTreeNode()
-    : rowStart(0), colStart(0), rowEnd(0), colEnd(0),
-    averageR(0), averageG(0), averageB(0), error(0), isDivisible(true), isLeaf(true) {
-    for (int i = 0; i < 4; i++) {
-        children[i] = nullptr;
+QuadTreeNode::QuadTreeNode(uint32_t index, int rowStart, int colStart, int rowEnd, int colEnd)
+    : index(index), rowStart(rowStart), colStart(colStart), rowEnd(rowEnd), colEnd(colEnd) {}
+
+QuadTreeNode QuadTreeNode::child(uint32_t firstChild, int i) const {
+    int rowMid = (rowStart + rowEnd) / 2;
+    int colMid = (colStart + colEnd) / 2;
+    switch (i) {
+        case 0: return QuadTreeNode(firstChild, rowStart, colStart, rowMid, colMid);
+        case 1: return QuadTreeNode(firstChild+1, rowStart, colMid+1, rowMid, colEnd);
+        case 2: return QuadTreeNode(firstChild+2, rowMid+1, colStart, rowEnd, colMid);
+        default: return QuadTreeNode(firstChild+3, rowMid+1, colMid+1, rowEnd, colEnd);
     }
 }
 
-QuadTreeNode::QuadTreeNode(int rowStart, int colStart, int rowEnd, int colEnd)
-    : rowStart(rowStart), colStart(colStart), rowEnd(rowEnd), colEnd(colEnd),
-    averageR(0), averageG(0), averageB(0), error(0), isDivisible(true), isLeaf(true) {
-    for (int i = 0; i < 4; i++) {
-        children[i] = nullptr;
+/* NodeArena */
+// The first block holds the root, the three nodes after it are unused
+NodeArena::NodeArena() : end(4) {
+    chunks.push_back(std::make_unique<Chunk>());
+    error(0) = 0;
+    firstChild(0) = 0;
+    flags(0) = DIVISIBLE;
+}
+
+uint32_t NodeArena::allocateChildren() {
+    uint32_t first;
+    if (!freeBlocks.empty()) {
+        first = freeBlocks.back();
+        freeBlocks.pop_back();
+    } else {
+        if (end > UINT32_MAX - 4) {
+            throw std::runtime_error("Node count exceeds the 32-bit node index.");
+        }
+        if ((end >> CHUNK_BITS) == chunks.size()) {
+            chunks.push_back(std::make_unique<Chunk>());
+        }
+        first = end;
+        end += 4;
+    }
+    resetBlock(first);
+    return first;
+}
+
+uint32_t NodeArena::allocateChildren(Reservation& reservation) {
+    if (reservation.next == reservation.end) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (end > UINT32_MAX - CHUNK_SIZE) {
+            throw std::runtime_error("Node count exceeds the 32-bit node index.");
+        }
+        if ((end >> CHUNK_BITS) == chunks.size()) {
+            chunks.push_back(std::make_unique<Chunk>());
+        }
+        // The rest of the chunk the arena ends in
+        reservation.next = end;
+        reservation.end = (end | (CHUNK_SIZE - 1)) + 1;
+        end = reservation.end;
+    }
+    uint32_t first = reservation.next;
+    reservation.next += 4;
+    resetBlock(first);
+    return first;
+}
+
+void NodeArena::resetBlock(uint32_t first) {
+    for (uint32_t i = first; i < first + 4; i++) {
+        error(i) = 0;
+        firstChild(i) = 0;
+        flags(i) = DIVISIBLE;
     }
 }
 
-// Error calculation that set the error attribute
-void QuadTreeNode::calculateError(const Image& image, ErrorMethod errorMethod){
+void NodeArena::reserveChunkTable() {
+    chunks.reserve((size_t)1 << (32 - CHUNK_BITS));
+}
+
+void NodeArena::releaseChildren(uint32_t index) {
+    uint32_t first = firstChild(index);
+    if (first == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        releaseChildren(first + i);
+    }
+    freeBlocks.push_back(first);
+    firstChild(index) = 0;
+}
+
+// Error calculation of the block
+template <typename ErrorPolicy, typename Sample>
+double QuadTreeNode::calculateError(const BasicImage<Sample>& image, const HistogramPyramid* histograms, const double* threshold) const {
     if (rowStart < 0 || colStart < 0 || rowEnd >= image.getHeight() || colEnd >= image.getWidth()) {
         throw std::out_of_range("Block dimensions are out of bounds.");
     }
 
-    double errorR, errorG, errorB;
-
-    errorR = ErrorMetrics::calculateChannelError(errorMethod,
-        image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::RED),
-        image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::RED));
-    errorG = ErrorMetrics::calculateChannelError(errorMethod,
-        image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::GREEN),
-        image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::GREEN));
-    errorB = ErrorMetrics::calculateChannelError(errorMethod,
-        image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::BLUE),
-        image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::BLUE));
-    
-    error = ErrorMetrics::calculateError(errorMethod, errorR, errorG, errorB);
-}
-
-// Average calculation that set the averageR, averageG, and averageB attributes
-void QuadTreeNode::calculateAverage(const Image& image){
-    averageR = 0;
-    averageG = 0;
-    averageB = 0;
-    int count = getArea();
-    if (isLeaf) {
-        // Each channel iterated separately to optimize cache hit due to CImg data structure
-        for (auto it = image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::RED);
-            it != image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::RED); ++it) {
-            averageR += *it;
+    constexpr double scale = SampleTraits<Sample>::scale;
+    double channelError[3];
+
+    // Single plane images are evaluated on one channel, the others have the same error
+    int channels = image.getPlaneCount();
+
+    if constexpr (ErrorPolicy::fromMoments) {
+        if (image.hasSummedAreaTables()) {
+            // Constant time regardless of the block size
+            for (int channel = Channels::RED; channel < channels; channel++) {
+                ChannelMoments moments;
+                moments.count = getArea();
+                moments.sum = image.getBlockSum(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel));
+                moments.squareSum = image.getBlockSquareSum(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel));
+                channelError[channel] = ErrorPolicy::channelError(moments, scale);
+            }
+            std::fill(channelError + channels, channelError + 3, channelError[Channels::RED]);
+            return ErrorPolicy::aggregate(channelError[Channels::RED], channelError[Channels::GREEN], channelError[Channels::BLUE]);
         }
-        for (auto it = image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::GREEN);
-        it != image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::GREEN); ++it) {
-            averageG += *it;
+    }
+
+    if constexpr (ErrorPolicy::method == MAX_PIXEL_DIFFERENCE) {
+        if (image.hasRangeIndex()) {
+            for (int channel = Channels::RED; channel < channels; channel++) {
+                std::pair<int, int> range = image.getBlockMinMax(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel));
+                channelError[channel] = (range.second - range.first) / scale;
+            }
+            std::fill(channelError + channels, channelError + 3, channelError[Channels::RED]);
+            return ErrorPolicy::aggregate(channelError[Channels::RED], channelError[Channels::GREEN], channelError[Channels::BLUE]);
         }
-        for (auto it = image.beginBlock(rowStart, colStart, rowEnd, colEnd, Channels::BLUE);
-        it != image.endBlock(rowStart, colStart, rowEnd, colEnd, Channels::BLUE); ++it) {
-            averageB += *it;
+    }
+
+    if constexpr (ErrorPolicy::fromHistogram) {
+        // Histograms of the large blocks are already merged in the pyramid
+        const ChannelHistogram* stored = histograms ? histograms->find(rowStart, colStart, rowEnd, colEnd) : nullptr;
+        std::array<ChannelHistogram, 3> blockHistograms;
+        if (stored == nullptr && ErrorPolicy::method == ENTROPY) {
+            // Entropy has no other way than reading the histograms from the pixels
+            blockHistograms = calculateHistograms(image);
+            stored = blockHistograms.data();
+        }
+        if (stored != nullptr) {
+            for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+                channelError[channel] = ErrorPolicy::channelError(stored[channel]);
+            }
+            return ErrorPolicy::aggregate(channelError[Channels::RED], channelError[Channels::GREEN], channelError[Channels::BLUE]);
         }
+    }
 
-        averageR /= count;
-        averageG /= count;
-        averageB /= count;
-    } else {
-        // Calculate average by way of weighted average of children
-        for (int i = 0; i < 4; i++) {
-            if (children[i] == nullptr) {
-                throw std::runtime_error("Child node is null.");
+    if constexpr (ErrorPolicy::method != ENTROPY) {
+        // Every other method is evaluated from a single pass over the rows of the block
+        auto spansOf = [&image](int channel, int rowStart, int colStart, int rowEnd, int colEnd, auto visit) {
+            image.forEachBlockSpan(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel), visit);
+        };
+        BlockStatistics statistics;
+        if constexpr (ErrorPolicy::needsDeviation) {
+            // The deviation needs the means before the pass
+            double means[3];
+            if (image.hasSummedAreaTables()) {
+                for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+                    means[channel] = (double)image.getBlockSum(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel)) / getArea();
+                }
+            } else {
+                BlockStatistics sums = ErrorMetrics::calculateSpanStatistics(spansOf, rowStart, colStart, rowEnd, colEnd, nullptr, channels);
+                for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+                    means[channel] = (double)sums.moments[channel].sum / getArea();
+                }
             }
-            children[i]->calculateAverage(image);
-            averageR += children[i]->averageR * children[i]->getArea();
-            averageG += children[i]->averageG * children[i]->getArea();
-            averageB += children[i]->averageB * children[i]->getArea();
+            statistics = calculateStatistics<ErrorPolicy>(spansOf, means, threshold, scale, channels);
+        } else {
+            statistics = calculateStatistics<ErrorPolicy>(spansOf, nullptr, threshold, scale, channels);
         }
-        averageR /= count;
-        averageG /= count;
-        averageB /= count;
+        if (statistics.moments[Channels::RED].count < (uint64_t)getArea()) {
+            // Settled before reading all of the rows, the bound already exceeds the threshold
+            return ErrorPolicy::errorBound(statistics, getArea(), scale);
+        }
+
+        for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+            channelError[channel] = ErrorPolicy::channelError(statistics, channel, scale);
+        }
+        return ErrorPolicy::aggregate(channelError[Channels::RED], channelError[Channels::GREEN], channelError[Channels::BLUE]);
+    }
+    return 0;
+}
+
+// Statistics of the block read in bands of rows
+// With a threshold, stops after the first band from which the block is known to exceed it
+template <typename ErrorPolicy, typename SpanAccessor>
+BlockStatistics QuadTreeNode::calculateStatistics(SpanAccessor spansOf, const double* means, const double* threshold, double scale,
+    int channels) const {
+    if (threshold == nullptr) {
+        return ErrorMetrics::calculateSpanStatistics(spansOf, rowStart, colStart, rowEnd, colEnd, means, channels);
     }
 
+    int bandRows = std::max(1, EARLY_EXIT_BAND_PIXELS / getWidth());
+    BlockStatistics statistics;
+    for (int bandStart = rowStart; bandStart <= rowEnd; bandStart += bandRows) {
+        int bandEnd = std::min(rowEnd, bandStart + bandRows - 1);
+        statistics.merge(ErrorMetrics::calculateSpanStatistics(spansOf, bandStart, colStart, bandEnd, colEnd, means, channels));
+        if (bandEnd < rowEnd && !ErrorPolicy::belowThreshold(ErrorPolicy::errorBound(statistics, getArea(), scale), *threshold)) {
+            break;
+        }
+    }
+    return statistics;
+}
+
+// Moments of each RGB channel of the block, read from the pixels
+template <typename Sample>
+std::array<ChannelMoments, 3> QuadTreeNode::calculateMoments(const BasicImage<Sample>& image) const {
+    auto spansOf = [&image](int channel, int rowStart, int colStart, int rowEnd, int colEnd, auto visit) {
+        image.forEachBlockSpan(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel), visit);
+    };
+    return ErrorMetrics::calculateSpanStatistics(spansOf, rowStart, colStart, rowEnd, colEnd, nullptr, image.getPlaneCount()).moments;
+}
+
+// Histogram of each RGB channel of the block, read from the pixels
+template <typename Sample>
+std::array<ChannelHistogram, 3> QuadTreeNode::calculateHistograms(const BasicImage<Sample>& image) const {
+    constexpr int shift = SampleTraits<Sample>::bits - 8;
+    std::array<ChannelHistogram, 3> histograms;
+    for (int channel = Channels::RED; channel < image.getPlaneCount(); channel++) {
+        ChannelHistogram& histogram = histograms[channel];
+        image.forEachBlockSpan(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel), [&histogram](const Sample* pixel, int length) {
+            for (int i = 0; i < length; i++) {
+                histogram.add(pixel[i] >> shift);
+            }
+        });
+    }
+    for (int channel = image.getPlaneCount(); channel <= Channels::BLUE; channel++) {
+        histograms[channel] = histograms[Channels::RED];
+    }
+    return histograms;
+}
+
+// Sum of each RGB channel of the block
+template <typename Sample>
+std::array<uint64_t, 3> QuadTreeNode::calculateSums(const BasicImage<Sample>& image) const {
+    std::array<uint64_t, 3> sums = { 0, 0, 0 };
+    if (image.hasSummedAreaTables()) {
+        for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+            sums[channel] = image.getBlockSum(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel));
+        }
+        return sums;
+    }
+    // Each channel read separately to follow the planar data structure
+    for (int channel = Channels::RED; channel < image.getPlaneCount(); channel++) {
+        uint64_t& sum = sums[channel];
+        image.forEachBlockSpan(rowStart, colStart, rowEnd, colEnd, static_cast<Channels>(channel), [&sum](const Sample* pixel, int length) {
+            for (int i = 0; i < length; i++) {
+                sum += pixel[i];
+            }
+        });
+    }
+    std::fill(sums.begin() + image.getPlaneCount(), sums.end(), sums[Channels::RED]);
+    return sums;
 }
 
 
@@ -87,181 +259,432 @@ void QuadTreeNode::calculateAverage(const Image& image){
 /* QuadTree */
 
 // Constructor and destructor
-QuadTree::QuadTree(const Image& image, int minBlockArea, double errorThreshold, ErrorMethod errorMethod)
+template <typename Sample>
+QuadTreeBase<Sample>::QuadTreeBase(const BasicImage<Sample>& image, int64_t minBlockArea, double errorThreshold, bool exactErrors)
     : image(image), nodeCount(1), treeDepth(1), depthOnLastColorCalc(0),
-    minBlockArea(minBlockArea), errorThreshold(errorThreshold), errorMethod(errorMethod) {
-    root = std::make_unique<QuadTreeNode>(0, 0, image.getHeight()-1, image.getWidth()-1);
-    root->calculateError(image, errorMethod);
+    minBlockArea(minBlockArea), errorThreshold(errorThreshold), exactErrors(exactErrors) {
+}
+template <typename Sample>
+QuadTreeBase<Sample>::~QuadTreeBase() {}
+
+template <typename ErrorPolicy, typename Sample>
+QuadTree<ErrorPolicy, Sample>::QuadTree(const BasicImage<Sample>& image, int64_t minBlockArea, double errorThreshold, bool exactErrors)
+    : QuadTreeBase<Sample>(image, minBlockArea, errorThreshold, exactErrors) {
+    if constexpr (usesHistograms) {
+        if ((uint64_t)image.getSize() > UINT32_MAX) {
+            throw std::invalid_argument("Histogram errors are limited to images of 2^32 pixels.");
+        }
+        histograms = std::make_unique<HistogramPyramid>(image);
+    }
+    calculateNodeError(root());
+    frontier.push_back(root());
 }
-QuadTree::~QuadTree() {}
+
+// Error of a node, only exact when the tree keeps exact errors
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::calculateNodeError(const QuadTreeNode& node) const {
+    nodes.error(node.index) = node.calculateError<ErrorPolicy>(image, histograms.get(), exactErrors ? nullptr : &errorThreshold);
+}
+template <typename ErrorPolicy, typename Sample>
+QuadTree<ErrorPolicy, Sample>::~QuadTree() {}
 
 // Getters
-int QuadTree::getNodeCount() const { return nodeCount; }
-int QuadTree::getTreeDepth() const { return treeDepth; }
+template <typename Sample>
+int64_t QuadTreeBase<Sample>::getNodeCount() const { return nodeCount; }
+template <typename Sample>
+int QuadTreeBase<Sample>::getTreeDepth() const { return treeDepth; }
+template <typename Sample>
+QuadTreeNode QuadTreeBase<Sample>::root() const {
+    return QuadTreeNode(0, 0, 0, image.getHeight()-1, image.getWidth()-1);
+}
 
 // Calculate average color of all nodes
-void QuadTree::calculateAverageColor() const {
-    if (root == nullptr) {
-        throw std::runtime_error("Root node is null.");
-    }
+template <typename Sample>
+void QuadTreeBase<Sample>::calculateAverageColor() const {
     if (depthOnLastColorCalc == treeDepth) {
         // Average color already calculated
         return;
     }
     // Recursively calculate average color for each node
-    root->calculateAverage(image);
+    calculateAverage(root());
+}
+
+// Averages are truncated as they are painted. Sums are exact, so every node's average is that of its pixels
+template <typename Sample>
+std::array<uint64_t, 3> QuadTreeBase<Sample>::calculateAverage(const QuadTreeNode& node) const {
+    std::array<uint64_t, 3> sums = { 0, 0, 0 };
+    if (nodes.isLeaf(node.index)) {
+        sums = node.calculateSums(image);
+    } else {
+        for (int i = 0; i < 4; i++) {
+            std::array<uint64_t, 3> childSums = calculateAverage(nodes.child(node, i));
+            for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+                sums[channel] += childSums[channel];
+            }
+        }
+    }
+    uint16_t* average = nodes.average(node.index);
+    for (int channel = Channels::RED; channel <= Channels::BLUE; channel++) {
+        average[channel] = (uint16_t)(sums[channel] / (uint64_t)node.getArea());
+    }
+    return sums;
 }
 
 /* Divide and conquer */
 
-// Divide nodes per level
-// Returns the number of nodes divided
-int QuadTree::divideNode(QuadTreeNode& node) {
-    int count = 0;
-    if (!node.isLeaf) {
-        // Case 1: Inner node
-        // Count how many nodes are created on this subtree
+// Divide a leaf of the frontier
+template <typename ErrorPolicy, typename Sample>
+bool QuadTree<ErrorPolicy, Sample>::divideLeaf(const QuadTreeNode& node, NodeArena::Reservation* reservation) {
+    // Check if it is divisible
+    if (!canDivide(node)) {
+        // The node is too small to be divided
+        nodes.flags(node.index) &= ~NodeArena::DIVISIBLE;
+        return false;
+    }
+    if (ErrorPolicy::belowThreshold(nodes.error(node.index), errorThreshold)) {
+        // The node is below the error threshold/the pixels are similar
+        nodes.flags(node.index) &= ~NodeArena::DIVISIBLE;
+        return false;
+    }
+    // Divide the node
+    createChildren(node, reservation);
+    for (int i = 0; i < 4; i++) {
+        // Calculate error for each child node
+        calculateNodeError(nodes.child(node, i));
+    }
+    return true;
+}
+
+// Check if a node is large enough to be divided
+template <typename Sample>
+bool QuadTreeBase<Sample>::canDivide(const QuadTreeNode& node) const {
+    if (node.getArea() <= minBlockArea) {
+        // The node is not larger than the minimum block size
+        return false;
+    }
+    if ((int64_t)(node.colEnd-node.colStart) * (node.rowEnd-node.rowStart) / 4 < minBlockArea) {
+        // If divided, the node will be smaller than the minimum block size
+        return false;
+    }
+    return true;
+}
+
+// Divide a node into its four children
+template <typename Sample>
+void QuadTreeBase<Sample>::createChildren(const QuadTreeNode& node, NodeArena::Reservation* reservation) {
+    // The blocks of the children follow from the node's, see QuadTreeNode::child
+    uint32_t first = reservation ? nodes.allocateChildren(*reservation) : nodes.allocateChildren();
+    nodes.firstChild(node.index) = first;
+}
+
+// Build the subtree of a node to full depth, then prune the blocks that are below the error threshold
+// Results in the same tree as dividing level by level since a node's division only depends on its own error
+template <typename ErrorPolicy, typename Sample>
+std::array<ChannelMoments, 3> QuadTree<ErrorPolicy, Sample>::buildNodeBottomUp(const QuadTreeNode& node, int depth) {
+    std::array<ChannelMoments, 3> moments;
+    if (depth < QUADTREE_MAX_DEPTH && canDivide(node)) {
+        // Moments of the block are merged from its children
+        createChildren(node);
         for (int i = 0; i < 4; i++) {
-            if (node.children[i] == nullptr) {
-                throw std::runtime_error("Child node is null.");
+            std::array<ChannelMoments, 3> childMoments = buildNodeBottomUp(nodes.child(node, i), depth+1);
+            for (int channel = 0; channel < 3; channel++) {
+                moments[channel].merge(childMoments[channel]);
             }
-            count += divideNode(*node.children[i]);
         }
-    } else if (!node.isDivisible) {
-        // Case 2: Node has been checked to be indivisible
-        // Node is ignored
-        count = 0;
     } else {
-        // Case 3: Leaf node
-        // Check if it is divisible
-        if (node.getArea() <= minBlockArea) {
-            // The node is not larger than the minimum block size
-            node.isDivisible = false;
-            count = 0;
-        } else if ((node.colEnd-node.colStart) * (node.rowEnd-node.rowStart) / 4 < minBlockArea) {
-            // If divided, the node will be smaller than the minimum block size
-            node.isDivisible = false;
-            count = 0;
-        } else if (ErrorMetrics::belowThreshold(node.error, errorThreshold, errorMethod)) {
-            // The node is below the error threshold/the pixels are similar
-            node.isDivisible = false;
-            count = 0;
-        } else {
-            // Divide the node
-            int rowMid = (node.rowStart + node.rowEnd) / 2;
-            int colMid = (node.colStart + node.colEnd) / 2;
-        
-            // Create children
-            // Divided into these 4 panels in order:
-            // 0 1
-            // 2 3
-            node.isLeaf = false;
-            node.children[0] = std::make_unique<QuadTreeNode>(node.rowStart, node.colStart, rowMid, colMid);
-            node.children[1] = std::make_unique<QuadTreeNode>(node.rowStart, colMid+1, rowMid, node.colEnd);
-            node.children[2] = std::make_unique<QuadTreeNode>(rowMid+1, node.colStart, node.rowEnd, colMid);
-            node.children[3] = std::make_unique<QuadTreeNode>(rowMid+1, colMid+1, node.rowEnd, node.colEnd);
-        
-            for (int i = 0; i < 4; i++) {
-                if (node.children[i] == nullptr) {
-                    throw std::runtime_error("Child node is null.");
-                }
-                // Calculate error for each child node
-                node.children[i]->calculateError(image, errorMethod);
-            }
-            count = 4;
+        // Full depth leaf. The only place where the pixels are read
+        moments = node.calculateMoments(image);
+    }
+
+    double& error = nodes.error(node.index);
+    if constexpr (ErrorPolicy::mergeable) {
+        error = ErrorPolicy::aggregate(
+            ErrorPolicy::channelError(moments[Channels::RED], SampleTraits<Sample>::scale),
+            ErrorPolicy::channelError(moments[Channels::GREEN], SampleTraits<Sample>::scale),
+            ErrorPolicy::channelError(moments[Channels::BLUE], SampleTraits<Sample>::scale));
+    }
+
+    if (nodes.isLeaf(node.index) || ErrorPolicy::belowThreshold(error, errorThreshold)) {
+        // The block would not have been divided, discard its subtree
+        nodes.flags(node.index) &= ~NodeArena::DIVISIBLE;
+        nodes.releaseChildren(node.index);
+    }
+    return moments;
+}
+
+// Count the nodes and the depth of a subtree
+template <typename Sample>
+void QuadTreeBase<Sample>::countSubtree(const QuadTreeNode& node, int depth) {
+    nodeCount++;
+    if (depth > treeDepth) { treeDepth = depth; }
+    if (!nodes.isLeaf(node.index)) {
+        for (int i = 0; i < 4; i++) {
+            countSubtree(nodes.child(node, i), depth+1);
         }
-    
     }
-    return count;
 }
 
 // Merge nodes. Calculate average RGB value from each leaf node
-void QuadTree::mergeNodeDepth(QuadTreeNode& node, Image& outputImage, int depth, bool addBorder) const {
+template <typename Sample>
+void QuadTreeBase<Sample>::mergeNodeDepth(const QuadTreeNode& node, std::vector<BlockFill>& blocks, int depth) const {
     // depth == 0   : Do nothing
     // depth == 1   : Fill the block with the average color
     // depth > 1    : Merge children nodes if exist
     // depth == -1  : Merge all leaf nodes
 
-    // node.isLeaf is only set to false when children of a node are created
+    // A node is only an inner node once its children are created
+    bool isLeaf = nodes.isLeaf(node.index);
 
     if (depth == 0) {
         // Do nothing
-    } else if (depth == 1 || node.isLeaf) {
+    } else if (depth == 1 || isLeaf) {
         // Fill the block with the average color
         // Average color should already be calculated
-        outputImage.paintBlockPixel(node.rowStart, node.colStart, node.rowEnd, node.colEnd,
-            node.averageR, node.averageG, node.averageB, addBorder);
-    } else if (depth > 1 && !node.isLeaf) {
+        const uint16_t* average = nodes.average(node.index);
+        blocks.push_back({ node.rowStart, node.colStart, node.rowEnd, node.colEnd, { average[0], average[1], average[2] } });
+    } else if (depth > 1 && !isLeaf) {
         // Merge nodes up to a certain depth which may not be leaf nodes
         // Or merge all leaf nodes
         for (int i = 0; i < 4; i++) {
-            mergeNodeDepth(*node.children[i], outputImage, depth-1, addBorder);
+            mergeNodeDepth(nodes.child(node, i), blocks, depth-1);
         }
-    } else if (depth == -1 && !node.isLeaf){
+    } else if (depth == -1 && !isLeaf){
         for (int i = 0; i < 4; i++) {
-            mergeNodeDepth(*node.children[i], outputImage, depth, addBorder);
+            mergeNodeDepth(nodes.child(node, i), blocks, depth);
         }
     }
 }
 
 // Merge nodes on variable error threshold
-void QuadTree::mergeNodeThreshold(QuadTreeNode& node, Image& outputImage, double errorThreshold, bool addBorder) const {
+template <typename Sample>
+void QuadTreeBase<Sample>::mergeNodeThreshold(const QuadTreeNode& node, std::vector<BlockFill>& blocks, double errorThreshold) const {
     // Blocks that already have low error is immediately merged even if it has children
-    if (node.error < errorThreshold || node.isLeaf) {
+    bool isLeaf = nodes.isLeaf(node.index);
+    if (nodes.error(node.index) < errorThreshold || isLeaf) {
         // Fill the block with the average color
         // Average color should already be calculated
-        outputImage.paintBlockPixel(node.rowStart, node.colStart, node.rowEnd, node.colEnd,
-            node.averageR, node.averageG, node.averageB, addBorder);
-    } else if (!node.isLeaf) {
+        const uint16_t* average = nodes.average(node.index);
+        blocks.push_back({ node.rowStart, node.colStart, node.rowEnd, node.colEnd, { average[0], average[1], average[2] } });
+    } else if (!isLeaf) {
         // Merge children nodes
         for (int i = 0; i < 4; i++) {
-            mergeNodeThreshold(*node.children[i], outputImage, errorThreshold, addBorder);
+            mergeNodeThreshold(nodes.child(node, i), blocks, errorThreshold);
         }
     }
 }
 
 // Divide all current divisible leaf nodes per level
-int QuadTree::divide() {
-    int count = divideNode(*root);
+// The frontier lists the leaves in the order of a walk down the tree, so are the children added to the next one
+template <typename ErrorPolicy, typename Sample>
+int64_t QuadTree<ErrorPolicy, Sample>::divide() {
+    nextFrontier.clear();
+    for (const QuadTreeNode& node : frontier) {
+        if (divideLeaf(node)) {
+            for (int i = 0; i < 4; i++) {
+                nextFrontier.push_back(nodes.child(node, i));
+            }
+        }
+    }
+    frontier.swap(nextFrontier);
+
+    int64_t count = frontier.size();
     nodeCount += count;
     if (count > 0) { treeDepth++; }
     return count;
 }
 
 // Divide until exhaustion
-void QuadTree::divideExhaust() {
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::divideExhaust() {
     // Divide until no more nodes can be divided
-    int count;
+    int64_t count;
     do {
         count = divide();
     } while (count > 0 && treeDepth < QUADTREE_MAX_DEPTH);
 }
 
+// Divide until exhaustion by merging block statistics from the leaves up
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::divideBottomUp() {
+    if constexpr (!ErrorPolicy::mergeable) {
+        divideExhaust();
+        return;
+    }
+    if (!nodes.isLeaf(0)) {
+        throw std::runtime_error("Bottom-up division requires an undivided tree.");
+    }
+
+    buildNodeBottomUp(root(), 1);
+    frontier.clear();    // Every leaf is final
+
+    // Tree information is only known once the tree is pruned
+    nodeCount = 0;
+    treeDepth = 0;
+    countSubtree(root(), 1);
+}
+
+// Divide a leaf and build its subtree to completion
+// A node's division only depends on its own error, so the subtrees result in the same tree as dividing level by level
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::buildNodeDepthFirst(const QuadTreeNode& node, int depth, NodeArena::Reservation* reservation,
+    int64_t& count, int& maxDepth) {
+    // divideExhaust stops once the tree is QUADTREE_MAX_DEPTH deep, the leaves at that depth are left as they are
+    if (depth >= QUADTREE_MAX_DEPTH || !divideLeaf(node, reservation)) {
+        return;
+    }
+    count += 4;
+    if (depth + 1 > maxDepth) { maxDepth = depth + 1; }
+    for (int i = 0; i < 4; i++) {
+        buildNodeDepthFirst(nodes.child(node, i), depth+1, reservation, count, maxDepth);
+    }
+}
+
+// Divide until exhaustion one subtree after the other
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::divideDepthFirst() {
+    if (!nodes.isLeaf(0)) {
+        throw std::runtime_error("Depth-first division requires an undivided tree.");
+    }
+    buildNodeDepthFirst(root(), 1, nullptr, nodeCount, treeDepth);
+    frontier.clear();    // Every leaf is final
+}
+
+// State of a parallel build
+template <typename ErrorPolicy, typename Sample>
+struct QuadTree<ErrorPolicy, Sample>::ParallelBuild {
+    // Tree information and node allocation of each worker, on cache lines of their own
+    struct alignas(64) Worker {
+        NodeArena::Reservation reservation;
+        int64_t nodeCount = 0;
+        int treeDepth = 0;
+    };
+
+    TaskPool pool;
+    int64_t taskMinArea;
+    std::vector<Worker> workers;
+
+    ParallelBuild(int threadCount, int64_t taskMinArea)
+        : pool(threadCount), taskMinArea(taskMinArea), workers(pool.getThreadCount()) {}
+};
+
+// Divide a leaf and build its subtree, the large blocks as tasks
+// The nodes of a subtree are only written by the task building it, so the tasks share nothing but the arena
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::buildNodeParallel(const QuadTreeNode& node, int depth, ParallelBuild& build, int worker) {
+    typename ParallelBuild::Worker& state = build.workers[worker];
+    if (depth >= QUADTREE_MAX_DEPTH || !divideLeaf(node, &state.reservation)) {
+        return;
+    }
+    state.nodeCount += 4;
+    if (depth + 1 > state.treeDepth) { state.treeDepth = depth + 1; }
+    for (int i = 0; i < 4; i++) {
+        QuadTreeNode child = nodes.child(node, i);
+        if (child.getArea() >= build.taskMinArea) {
+            build.pool.spawn(worker, [this, child, depth, &build](int taskWorker) {
+                buildNodeParallel(child, depth+1, build, taskWorker);
+            });
+        } else {
+            buildNodeDepthFirst(child, depth+1, &state.reservation, state.nodeCount, state.treeDepth);
+        }
+    }
+}
+
+// Divide until exhaustion on several threads
+template <typename ErrorPolicy, typename Sample>
+void QuadTree<ErrorPolicy, Sample>::divideParallel(int threadCount, int64_t taskMinArea) {
+    if (!nodes.isLeaf(0)) {
+        throw std::runtime_error("Parallel division requires an undivided tree.");
+    }
+    if (taskMinArea < 1) {
+        throw std::invalid_argument("Task minimum area must be at least 1.");
+    }
+    nodes.reserveChunkTable();
+
+    ParallelBuild build(threadCount, taskMinArea);
+    build.pool.run([this, &build](int worker) {
+        buildNodeParallel(root(), 1, build, worker);
+    });
+
+    // Tree information of the workers
+    for (const typename ParallelBuild::Worker& state : build.workers) {
+        nodeCount += state.nodeCount;
+        if (state.treeDepth > treeDepth) { treeDepth = state.treeDepth; }
+    }
+    frontier.clear();    // Every leaf is final
+}
+
 // Merge the current tree into an Image up to a certain depth
-Image QuadTree::merge(int depth, bool addBorder) const {
-    // Create a copy of the original image
-    Image outputImage = image;
+template <typename Sample>
+BasicImage<Sample> QuadTreeBase<Sample>::merge(int depth, bool addBorder) const {
+    // Every pixel is painted over, no need to copy the original image
+    BasicImage<Sample> outputImage(image.getWidth(), image.getHeight(), image.getPlaneCount());
+    mergeInto(outputImage, depth, addBorder);
+    return outputImage;
+}
+template <typename Sample>
+void QuadTreeBase<Sample>::mergeInto(BasicImage<Sample>& outputImage, int depth, bool addBorder) const {
     if (depth < -1) {
         throw std::invalid_argument("Depth must be greater than or equal to -1.");
     }
     if (depth > treeDepth) {
         throw std::invalid_argument("Depth must be less than or equal to the current tree depth.");
     }
+    if (outputImage.getWidth() != image.getWidth() || outputImage.getHeight() != image.getHeight()) {
+        throw std::invalid_argument("Output image dimensions must match the compressed image.");
+    }
+    if (outputImage.getPlaneCount() != image.getPlaneCount()) {
+        throw std::invalid_argument("Output image planes must match the compressed image.");
+    }
 
+    if (depth == 0) {
+        // No block is painted, the output is the original image
+        outputImage = BasicImage<Sample>(image);
+        return;
+    }
     calculateAverageColor(); // Calculate average color for each node
-    mergeNodeDepth(*root, outputImage, depth, addBorder);
-    return outputImage;
+    std::vector<BlockFill> blocks;
+    mergeNodeDepth(root(), blocks, depth);
+    outputImage.fillBlocks(blocks, addBorder);
 }
 
 // Merge with variable error threshold
-Image QuadTree::mergeThreshold(double errorThreshold, bool addBorder) const {
-    // Create a copy of the original image
-    Image outputImage = image;
+template <typename Sample>
+BasicImage<Sample> QuadTreeBase<Sample>::mergeThreshold(double errorThreshold, bool addBorder) const {
+    BasicImage<Sample> outputImage(image.getWidth(), image.getHeight(), image.getPlaneCount());
+    mergeThresholdInto(outputImage, errorThreshold, addBorder);
+    return outputImage;
+}
+template <typename Sample>
+void QuadTreeBase<Sample>::mergeThresholdInto(BasicImage<Sample>& outputImage, double errorThreshold, bool addBorder) const {
     if (errorThreshold < 0) {
         throw std::invalid_argument("Error threshold must be greater than or equal to 0.");
     }
+    if (!exactErrors) {
+        throw std::runtime_error("Node errors are only bounds, the tree was built without exact errors.");
+    }
+    if (outputImage.getWidth() != image.getWidth() || outputImage.getHeight() != image.getHeight()) {
+        throw std::invalid_argument("Output image dimensions must match the compressed image.");
+    }
+    if (outputImage.getPlaneCount() != image.getPlaneCount()) {
+        throw std::invalid_argument("Output image planes must match the compressed image.");
+    }
 
     calculateAverageColor(); // Calculate average color for each node
-    mergeNodeThreshold(*root, outputImage, errorThreshold, addBorder);
-    return outputImage;
-}
\ No newline at end of file
+    std::vector<BlockFill> blocks;
+    mergeNodeThreshold(root(), blocks, errorThreshold);
+    outputImage.fillBlocks(blocks, addBorder);
+}
+
+// Trees for each sample type and error policy
+template class QuadTreeBase<Quantum>;
+template class QuadTreeBase<uint16_t>;
+template class QuadTree<VariancePolicy, Quantum>;
+template class QuadTree<MeanAbsoluteDeviationPolicy, Quantum>;
+template class QuadTree<MaxPixelDifferencePolicy, Quantum>;
+template class QuadTree<EntropyPolicy, Quantum>;
+template class QuadTree<SSIMPolicy, Quantum>;
+template class QuadTree<VariancePolicy, uint16_t>;
+template class QuadTree<MeanAbsoluteDeviationPolicy, uint16_t>;
+template class QuadTree<MaxPixelDifferencePolicy, uint16_t>;
+template class QuadTree<EntropyPolicy, uint16_t>;
+template class QuadTree<SSIMPolicy, uint16_t>;
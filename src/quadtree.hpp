@@ -2,96 +2,298 @@
 #define QUADTREE_HPP
 
 #include <array>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <type_traits>
 #include "image.hpp"
 #include "error.hpp"
+#include "histogram.hpp"
 
 #define QUADTREE_MAX_DEPTH 50
 
+// Blocks of at least this area are built as tasks of their own by the parallel build, smaller ones by the task
+// that divides their parent
+#define PARALLEL_TASK_MIN_AREA 65536
+
+// Pixels per row band read before checking whether a block is already known to exceed the threshold
+#define EARLY_EXIT_BAND_PIXELS 1024
+
+// Order in which the tree is constructed. Every mode results in the same tree
+enum TreeBuildMode {
+    LEVEL_ORDER = 1,    // Divide all divisible leaves one level at a time
+    BOTTOM_UP = 2,      // Build the full depth tree first and merge block statistics from the leaves up
+    DEPTH_FIRST = 3,    // Build each subtree to completion before the next one, in a single pass
+    PARALLEL = 4        // Depth first on several threads, see divideParallel
+};
+
+// Node of a tree being visited: its index in the NodeArena of the tree and the block of the image it covers
+// The block is not stored in the tree, it is derived from the image size at the root and from the parent's
+// block and the quadrant on the way down
 class QuadTreeNode {
 public:
-    // Children
-    std::array<std::unique_ptr<QuadTreeNode>, 4> children;
-
-    // Node data
-    double averageR, averageG, averageB;
-    double error;
+    uint32_t index;
 
     // Block boundary
     int rowStart, colStart;
     int rowEnd, colEnd;
 
-    bool isDivisible;   // Default to true
-    bool isLeaf;        // Default to true
-
     // Constructor
-    QuadTreeNode();
-    QuadTreeNode(int rowStart, int colStart, int rowEnd, int colEnd);
-    ~QuadTreeNode() {};
+    QuadTreeNode(uint32_t index, int rowStart, int colStart, int rowEnd, int colEnd);
 
     // Dimension getter
     int getWidth() const { return colEnd - colStart + 1; }
     int getHeight() const { return rowEnd - rowStart + 1; }
-    int getArea() const { return getWidth() * getHeight(); }
+    int64_t getArea() const { return (int64_t)getWidth() * getHeight(); }
+
+    // Child in quadrant i of the block, the children being the four consecutive nodes from firstChild
+    // Divided into these 4 panels in order:
+    // 0 1
+    // 2 3
+    QuadTreeNode child(uint32_t firstChild, int i) const;
 
-    // Error calculation that set the error attribute
-    void calculateError(const Image& image, ErrorMethod errorMethod);
-    
-    // Average calculation that set the averageR, averageG, and averageB attributes
-    void calculateAverage(const Image& image);
+    // Error of the block, compiled for one error policy and sample type
+    // Errors are on the 8-bit scale whatever the sample type, see SampleTraits::scale
+    // ENTROPY and MAD take the block histograms from the pyramid when given and the block is stored in it
+    // With a threshold, the pixels are read until the block is known to exceed it and the error is then only
+    // a bound that lies past the threshold. The comparison against the threshold is the same as the exact error's
+    template <typename ErrorPolicy, typename Sample>
+    double calculateError(const BasicImage<Sample>& image, const HistogramPyramid* histograms = nullptr, const double* threshold = nullptr) const;
+
+    // Statistics of the block read from the pixels, see calculateError for the threshold and the scale
+    // Only the first channels are read, see ErrorMetrics::calculateSpanStatistics
+    template <typename ErrorPolicy, typename SpanAccessor>
+    BlockStatistics calculateStatistics(SpanAccessor spansOf, const double* means, const double* threshold, double scale = 1,
+        int channels = 3) const;
+
+    // Pixels are read through Image::forEachBlockSpan, so every calculation runs on either pixel layout
+
+    // Moments of each RGB channel of the block, read from the pixels
+    template <typename Sample>
+    std::array<ChannelMoments, 3> calculateMoments(const BasicImage<Sample>& image) const;
+
+    // Histogram of each RGB channel of the block, read from the pixels
+    template <typename Sample>
+    std::array<ChannelHistogram, 3> calculateHistograms(const BasicImage<Sample>& image) const;
+
+    // Sum of each RGB channel of the block, read from the summed-area tables or the pixels
+    template <typename Sample>
+    std::array<uint64_t, 3> calculateSums(const BasicImage<Sample>& image) const;
 };
 
-class QuadTree {
+// Data of the nodes of a tree, with the four children of a node allocated together as one block referred to by a
+// 32-bit index. The arena grows by chunks, so the data of a node never moves while others are allocated, and the
+// whole tree is freed chunk by chunk instead of node by node. The root is node 0 and the blocks of children start
+// at multiples of 4, so a block never straddles two chunks
+// Each field is stored in its own array in the chunk: the divisions only read the errors, child indices and flags,
+// 13 bytes per node, and the averages are only read when merging. The blocks are not stored, see QuadTreeNode
+class NodeArena {
 private:
-    // Root node
-    std::unique_ptr<QuadTreeNode> root;
+    static constexpr int CHUNK_BITS = 14;   // 16384 nodes per chunk
+    static constexpr uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+
+    struct Chunk {
+        double error[CHUNK_SIZE];
+        uint32_t firstChild[CHUNK_SIZE];   // 0 when there are none since the root is never a child
+        uint8_t flags[CHUNK_SIZE];
+        uint16_t average[CHUNK_SIZE][3];    // Truncated average of each RGB channel, as painted
+    };
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    uint32_t end;                       // Index past the last allocated block
+    std::vector<uint32_t> freeBlocks;   // Blocks released by pruning, reused before the arena grows
+    std::mutex mutex;                   // Held while a reservation is refilled
+
+    Chunk& chunkOf(uint32_t index) const { return *chunks[index >> CHUNK_BITS]; }
+    static uint32_t offsetOf(uint32_t index) { return index & (CHUNK_SIZE - 1); }
+
+    // Make the block at first four new leaves
+    void resetBlock(uint32_t first);
+
+public:
+    // Flags of a node
+    static constexpr uint8_t DIVISIBLE = 1;     // Not yet checked to be indivisible, set on new nodes
+
+    // Blocks taken from the arena by one thread, up to the end of a chunk at a time, to allocate without locking
+    struct Reservation {
+        uint32_t next = 0, end = 0;
+    };
+
+    NodeArena();
+
+    // Fields of a node, mutable through a const arena as they were through the pointers to the nodes before the arena
+    double& error(uint32_t index) const { return chunkOf(index).error[offsetOf(index)]; }
+    uint32_t& firstChild(uint32_t index) const { return chunkOf(index).firstChild[offsetOf(index)]; }
+    uint8_t& flags(uint32_t index) const { return chunkOf(index).flags[offsetOf(index)]; }
+    uint16_t* average(uint32_t index) const { return chunkOf(index).average[offsetOf(index)]; }
+
+    // A node is a leaf until its children are created, and again once they are released
+    bool isLeaf(uint32_t index) const { return firstChild(index) == 0; }
+    bool isDivisible(uint32_t index) const { return flags(index) & DIVISIBLE; }
+
+    // Child i of an inner node
+    QuadTreeNode child(const QuadTreeNode& node, int i) const { return node.child(firstChild(node.index), i); }
+
+    // Allocate a block of four new leaves, returns the index of the first
+    uint32_t allocateChildren();
+    // Same, from a reservation which is refilled from the arena once used up
+    // Safe to call from several threads, each with its own reservation, once the chunk table is reserved
+    uint32_t allocateChildren(Reservation& reservation);
+
+    // Make room in the chunk table for every chunk the 32-bit indices can address, so that it never moves while
+    // other threads read nodes. Only address space is reserved, the chunks are still allocated as the arena grows
+    void reserveChunkTable();
+    // Release the blocks of the subtree below a node, which becomes a leaf
+    void releaseChildren(uint32_t index);
+};
+
+// Policy independent part of the tree: the nodes, the tree information and the merging into images
+// Compiled for each sample type, the merged images have the samples of the compressed image
+template <typename Sample>
+class QuadTreeBase {
+protected:
+    // Node data, the root first
+    NodeArena nodes;
 
     // Image to be compressed
-    const Image& image;
+    const BasicImage<Sample>& image;
 
     // Tree information
-    int nodeCount;  // Root, leaves and internal nodes
+    int64_t nodeCount;  // Root, leaves and internal nodes
     int treeDepth;  // Incremented with each divide call
     int depthOnLastColorCalc; // Depth of the last average color calculation
 
     // Compression parameters
-    int minBlockArea;
+    int64_t minBlockArea;
     double errorThreshold;
-    ErrorMethod errorMethod;
+
+    // Whether the node errors are exact or may stop at a bound once past the threshold
+    // Merging with another threshold needs the exact errors
+    bool exactErrors;
+
+    // Root node, covering the whole image
+    QuadTreeNode root() const;
 
     // Calculate all node's average color
     void calculateAverageColor() const;
 
-    // Divide nodes
-    int divideNode(QuadTreeNode& node);
+    // Store the averages of a subtree, inner nodes from the sums of their children. Returns the sums of the block
+    std::array<uint64_t, 3> calculateAverage(const QuadTreeNode& node) const;
+
+    // Check if a node is large enough to be divided
+    bool canDivide(const QuadTreeNode& node) const;
 
-    // Merge nodes up to variable depth. Calculate average RGB value from each leaf node
-    void mergeNodeDepth(QuadTreeNode& node, Image& outputImage, int depth, bool addBorder) const;
+    // Divide a node into its four children, allocated from the reservation when given
+    void createChildren(const QuadTreeNode& node, NodeArena::Reservation* reservation = nullptr);
+
+    // Count the nodes and the depth of a subtree
+    void countSubtree(const QuadTreeNode& node, int depth);
+
+    // Merge nodes up to variable depth. Collect the blocks to be painted with the average RGB value of each node
+    void mergeNodeDepth(const QuadTreeNode& node, std::vector<BlockFill>& blocks, int depth) const;
 
     // Merge nodes on variable error threshold
-    void mergeNodeThreshold(QuadTreeNode& node, Image& outputImage, double errorThreshold, bool addBorder) const;
+    void mergeNodeThreshold(const QuadTreeNode& node, std::vector<BlockFill>& blocks, double errorThreshold) const;
 
 public:
     // Constructor and destructor
-    QuadTree(const Image& image, int minBlockSize, double errorThreshold, ErrorMethod errorMethod);
-    ~QuadTree();
+    QuadTreeBase(const BasicImage<Sample>& image, int64_t minBlockArea, double errorThreshold, bool exactErrors = true);
+    virtual ~QuadTreeBase();
 
     // Getters
-    int getNodeCount() const;
+    int64_t getNodeCount() const;
     int getTreeDepth() const;
 
     // Divide all current divisible leaf nodes per level
-    int divide();
+    virtual int64_t divide() = 0;
 
     // Divide until exhaustion
-    void divideExhaust();
-    
+    virtual void divideExhaust() = 0;
+
+    // Divide until exhaustion by merging block statistics from the leaves up
+    // Pixels are only read at the full depth leaves. Falls back to divideExhaust for non mergeable error methods
+    virtual void divideBottomUp() = 0;
+
+    // Divide until exhaustion one subtree after the other, each one while its blocks are still in the cache
+    // The tree, its depth and node count are the same as divideExhaust's
+    virtual void divideDepthFirst() = 0;
+
+    // Divide until exhaustion on several threads, the subtrees of the blocks of at least taskMinArea pixels being
+    // built as tasks of a work-stealing pool. 0 threads for one per hardware thread
+    // The tree, its depth and node count are the same as divideExhaust's
+    virtual void divideParallel(int threadCount = 0, int64_t taskMinArea = PARALLEL_TASK_MIN_AREA) = 0;
+
     // Merge the current tree into an Image
-    Image merge(int depth=-1, bool addBorder=false) const;
+    BasicImage<Sample> merge(int depth=-1, bool addBorder=false) const;
+    // Same, rendered into an image of the same dimensions which can be reused across calls
+    // Every pixel is painted over, so the image may be uninitialized
+    void mergeInto(BasicImage<Sample>& outputImage, int depth=-1, bool addBorder=false) const;
 
     // Merge with variable error threshold
-    Image mergeThreshold(double errorThreshold, bool addBorder=false) const;
+    BasicImage<Sample> mergeThreshold(double errorThreshold, bool addBorder=false) const;
+    void mergeThresholdInto(BasicImage<Sample>& outputImage, double errorThreshold, bool addBorder=false) const;
+};
+
+// Tree compiled for one error policy, see error.hpp, and one sample type
+template <typename ErrorPolicy, typename Sample = Quantum>
+class QuadTree : public QuadTreeBase<Sample> {
+private:
+    using Base = QuadTreeBase<Sample>;
+    using Base::nodes;
+    using Base::image;
+    using Base::nodeCount;
+    using Base::treeDepth;
+    using Base::errorThreshold;
+    using Base::exactErrors;
+    using Base::root;
+    using Base::canDivide;
+    using Base::createChildren;
+    using Base::countSubtree;
+
+    // Histograms of the first levels of blocks are kept for ENTROPY, and for MAD on 8-bit samples only since
+    // 16-bit deviations are not exact on the 8-bit bins
+    static constexpr bool usesHistograms = ErrorPolicy::method == ENTROPY
+        || (ErrorPolicy::fromHistogram && std::is_same_v<Sample, Quantum>);
+
+    // Histograms of the first levels of blocks. Only built for the policies that use histograms
+    std::unique_ptr<HistogramPyramid> histograms;
+
+    // Divisible leaves, the nodes created by the last division. Each division only visits these instead of
+    // walking the tree down to them, and the next frontier is filled with their children
+    std::vector<QuadTreeNode> frontier, nextFrontier;
+
+    // Divide a leaf of the frontier, or mark it as indivisible. Returns whether it was divided
+    // The children are allocated from the reservation when given
+    bool divideLeaf(const QuadTreeNode& node, NodeArena::Reservation* reservation = nullptr);
+
+    // Divide a leaf at the given depth, then its children's subtrees one after the other
+    // The new nodes are allocated from the reservation when given, and counted into count and maxDepth
+    void buildNodeDepthFirst(const QuadTreeNode& node, int depth, NodeArena::Reservation* reservation,
+        int64_t& count, int& maxDepth);
+
+    // Divide a leaf at the given depth on a worker of the pool, then its children's subtrees, spawned as tasks
+    // when their blocks are large enough
+    struct ParallelBuild;
+    void buildNodeParallel(const QuadTreeNode& node, int depth, ParallelBuild& build, int worker);
+
+    // Build the subtree of a node to full depth, then prune the blocks that are below the error threshold
+    // Returns the moments of the block which are merged into the parent's moments
+    std::array<ChannelMoments, 3> buildNodeBottomUp(const QuadTreeNode& node, int depth);
+
+    // Calculate the error of a node
+    void calculateNodeError(const QuadTreeNode& node) const;
+
+public:
+    // Constructor and destructor
+    QuadTree(const BasicImage<Sample>& image, int64_t minBlockSize, double errorThreshold, bool exactErrors = true);
+    ~QuadTree();
 
+    int64_t divide() override;
+    void divideExhaust() override;
+    void divideBottomUp() override;
+    void divideDepthFirst() override;
+    void divideParallel(int threadCount = 0, int64_t taskMinArea = PARALLEL_TASK_MIN_AREA) override;
 };
 
 #endif
\ No newline at end of file
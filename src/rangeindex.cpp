@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <limits>
+#include "rangeindex.hpp"
+#include "rowkernels.hpp"
+
+// Floor of log2 of a positive number
+static int floorLog2(int value) {
+    int level = 0;
+    while ((2 << level) <= value) {
+        level++;
+    }
+    return level;
+}
+
+template <typename Sample>
+RangeIndex<Sample>::RangeIndex(const BasicImage<Sample>& image)
+    : image(image), tileRows(image.getHeight() / RANGE_INDEX_TILE), tileCols(image.getWidth() / RANGE_INDEX_TILE) {
+    levels = tileRows > 0 && tileCols > 0 ? floorLog2(std::min(tileRows, tileCols)) + 1 : 0;
+    minimums.resize(3 * levels);
+    maximums.resize(3 * levels);
+    if (tileRows == 0 || tileCols == 0) {
+        // Image smaller than a tile, every block is read from the pixels
+        return;
+    }
+
+    const RowKernels& kernels = RowKernels::active();
+    // Single plane images are indexed once, every channel reads the red tables
+    for (int channel = Channels::RED; channel < image.getPlaneCount(); channel++) {
+        // Single tiles from the pixels
+        std::vector<Sample>& tileMin = minimums[tableIndex(channel, 0)];
+        std::vector<Sample>& tileMax = maximums[tableIndex(channel, 0)];
+        tileMin.resize((size_t)tileRows * tileCols);
+        tileMax.resize((size_t)tileRows * tileCols);
+        for (int i = 0; i < tileRows; i++) {
+            for (int j = 0; j < tileCols; j++) {
+                RowReduction reduction;
+                for (int row = i * RANGE_INDEX_TILE; row < (i + 1) * RANGE_INDEX_TILE; row++) {
+                    kernels.reduceRow(image.getRow(row, static_cast<Channels>(channel)) + j * RANGE_INDEX_TILE, RANGE_INDEX_TILE, reduction);
+                }
+                tileMin[(size_t)i * tileCols + j] = reduction.min;
+                tileMax[(size_t)i * tileCols + j] = reduction.max;
+            }
+        }
+
+        // Each level doubles the side of the previous one, a square being the four squares of the previous level
+        for (int level = 1; level < levels; level++) {
+            const std::vector<Sample>& previousMin = minimums[tableIndex(channel, level - 1)];
+            const std::vector<Sample>& previousMax = maximums[tableIndex(channel, level - 1)];
+            size_t right = (size_t)1 << (level - 1), below = right * tileCols;
+            int rowCount = tileRows - (1 << level) + 1;
+            int colCount = tileCols - (1 << level) + 1;
+
+            std::vector<Sample>& levelMin = minimums[tableIndex(channel, level)];
+            std::vector<Sample>& levelMax = maximums[tableIndex(channel, level)];
+            levelMin.resize((size_t)tileRows * tileCols);
+            levelMax.resize((size_t)tileRows * tileCols);
+            for (int i = 0; i < rowCount; i++) {
+                for (int j = 0; j < colCount; j++) {
+                    size_t index = (size_t)i * tileCols + j;
+                    levelMin[index] = std::min(std::min(previousMin[index], previousMin[index + right]),
+                        std::min(previousMin[index + below], previousMin[index + below + right]));
+                    levelMax[index] = std::max(std::max(previousMax[index], previousMax[index + right]),
+                        std::max(previousMax[index + below], previousMax[index + below + right]));
+                }
+            }
+        }
+    }
+}
+
+template <typename Sample>
+size_t RangeIndex<Sample>::tableIndex(int channel, int level) const {
+    return (size_t)channel * levels + level;
+}
+
+template <typename Sample>
+void RangeIndex<Sample>::scanBlock(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel, int& min, int& max) const {
+    if (rowStart > rowEnd || colStart > colEnd) {
+        return;
+    }
+    RowReduction reduction;
+    reduction.min = min;
+    reduction.max = max;
+    const RowKernels& kernels = RowKernels::active();
+    for (int row = rowStart; row <= rowEnd; row++) {
+        kernels.reduceRow(image.getRow(row, channel) + colStart, colEnd - colStart + 1, reduction);
+    }
+    min = reduction.min;
+    max = reduction.max;
+}
+
+template <typename Sample>
+std::pair<int, int> RangeIndex<Sample>::getBlockMinMax(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const {
+    if (rowStart < 0 || colStart < 0 || rowEnd >= image.getHeight() || colEnd >= image.getWidth()) {
+        throw std::out_of_range("Coordinates are out of bounds.");
+    }
+    if (image.getPlaneCount() == 1) {
+        channel = Channels::RED;
+    }
+    int min = std::numeric_limits<Sample>::max(), max = 0;
+
+    // Whole tiles inside the block
+    int firstTileRow = (rowStart + RANGE_INDEX_TILE - 1) / RANGE_INDEX_TILE;
+    int lastTileRow = std::min((rowEnd + 1) / RANGE_INDEX_TILE, tileRows) - 1;
+    int firstTileCol = (colStart + RANGE_INDEX_TILE - 1) / RANGE_INDEX_TILE;
+    int lastTileCol = std::min((colEnd + 1) / RANGE_INDEX_TILE, tileCols) - 1;
+    if (firstTileRow > lastTileRow || firstTileCol > lastTileCol) {
+        // Block does not cover a whole tile
+        scanBlock(rowStart, colStart, rowEnd, colEnd, channel, min, max);
+        return { min, max };
+    }
+
+    // Overlapping squares of 2^level x 2^level tiles cover the whole tiles, the last ones along each axis are
+    // aligned to the last tile. Four of them when the tiles make a square
+    int level = floorLog2(std::min(lastTileRow - firstTileRow + 1, lastTileCol - firstTileCol + 1));
+    int side = 1 << level;
+    const std::vector<Sample>& levelMin = minimums[tableIndex(channel, level)];
+    const std::vector<Sample>& levelMax = maximums[tableIndex(channel, level)];
+    int lastRow = lastTileRow - side + 1, lastCol = lastTileCol - side + 1;
+    for (int i = firstTileRow;; i = std::min(i + side, lastRow)) {
+        for (int j = firstTileCol;; j = std::min(j + side, lastCol)) {
+            size_t index = (size_t)i * tileCols + j;
+            min = std::min<int>(min, levelMin[index]);
+            max = std::max<int>(max, levelMax[index]);
+            if (j == lastCol) {
+                break;
+            }
+        }
+        if (i == lastRow) {
+            break;
+        }
+    }
+
+    // Partial tiles along the border
+    int innerRowStart = firstTileRow * RANGE_INDEX_TILE, innerRowEnd = (lastTileRow + 1) * RANGE_INDEX_TILE - 1;
+    int innerColStart = firstTileCol * RANGE_INDEX_TILE, innerColEnd = (lastTileCol + 1) * RANGE_INDEX_TILE - 1;
+    scanBlock(rowStart, colStart, innerRowStart - 1, colEnd, channel, min, max);               // Top
+    scanBlock(innerRowEnd + 1, colStart, rowEnd, colEnd, channel, min, max);                   // Bottom
+    scanBlock(innerRowStart, colStart, innerRowEnd, innerColStart - 1, channel, min, max);     // Left
+    scanBlock(innerRowStart, innerColEnd + 1, innerRowEnd, colEnd, channel, min, max);         // Right
+    return { min, max };
+}
+
+// Indexes for each sample type
+template class RangeIndex<Quantum>;
+template class RangeIndex<uint16_t>;
@@ -0,0 +1,39 @@
+#ifndef RANGEINDEX_HPP
+#define RANGEINDEX_HPP
+
+#include <vector>
+#include <utility>
+#include "image.hpp"
+
+#define RANGE_INDEX_TILE 16     // Side of the tiles the index is built on
+
+// Block-decomposed min/max index of the RGB channels of an image
+// Stores the min and max of every RANGE_INDEX_TILE x RANGE_INDEX_TILE tile together with a sparse table of squares
+// of 2^level x 2^level tiles over the tile grid, so the whole tiles of a square block are answered with four
+// lookups, and those of a longer block with a few more along its long side. Only the square levels are kept, which
+// takes O(tiles * log(tiles)) memory. Only the partial tiles along the border of a block are read from the pixels
+template <typename Sample>
+class RangeIndex {
+private:
+    const BasicImage<Sample>& image;
+
+    // Tile grid, only whole tiles are indexed
+    int tileRows, tileCols;
+    int levels;
+
+    // Min and max over 2^level x 2^level tiles starting at each tile, one grid per channel and level
+    std::vector<std::vector<Sample>> minimums, maximums;
+
+    size_t tableIndex(int channel, int level) const;
+
+    // Min and max of a block read from the pixels
+    void scanBlock(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel, int& min, int& max) const;
+
+public:
+    RangeIndex(const BasicImage<Sample>& image);
+
+    // Min and max of a channel of a block
+    std::pair<int, int> getBlockMinMax(int rowStart, int colStart, int rowEnd, int colEnd, Channels channel) const;
+};
+
+#endif
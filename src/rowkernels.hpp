@@ -0,0 +1,353 @@
+#ifndef ROWKERNELS_HPP
+#define ROWKERNELS_HPP
+
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROWKERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+// Reductions over a contiguous row of 8-bit or 16-bit samples
+// Every implementation accumulates exact integers so the results do not depend on the instruction set
+struct RowReduction {
+    uint64_t sum = 0;
+    uint64_t squareSum = 0;
+    int min = std::numeric_limits<int>::max();
+    int max = 0;
+};
+
+struct RowKernels {
+    const char* name;
+
+    // Accumulate the sum, sum of squares, min and max of a row into the result
+    void (*reduce)(const uint8_t* row, int length, RowReduction& result);
+
+    // Accumulate the count and the sum of the values of a row that are greater than the pivot
+    // Σ|x - mean| follows from these with the pivot at floor(mean)
+    void (*sumAbove)(const uint8_t* row, int length, int pivot, uint64_t& count, uint64_t& sum);
+
+    // Interleave a row of the red, green and blue planes into BGR pixels, as taken by the GIF encoder
+    void (*interleaveBGR)(const uint8_t* red, const uint8_t* green, const uint8_t* blue, int length, uint8_t* bgr);
+
+    // Same reductions over 16-bit samples
+    void (*reduce16)(const uint16_t* row, int length, RowReduction& result);
+    void (*sumAbove16)(const uint16_t* row, int length, int pivot, uint64_t& count, uint64_t& sum);
+
+    // Reductions picked by the sample type
+    void reduceRow(const uint8_t* row, int length, RowReduction& result) const { reduce(row, length, result); }
+    void reduceRow(const uint16_t* row, int length, RowReduction& result) const { reduce16(row, length, result); }
+    void sumAboveRow(const uint8_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) const {
+        sumAbove(row, length, pivot, count, sum);
+    }
+    void sumAboveRow(const uint16_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) const {
+        sumAbove16(row, length, pivot, count, sum);
+    }
+
+    // Implementation for the current CPU, chosen once from CPUID
+    static const RowKernels& active();
+};
+
+/* Scalar */
+template <typename Sample>
+inline void scalarReduceSamples(const Sample* row, int length, RowReduction& result) {
+    uint64_t sum = 0, squareSum = 0;
+    int min = result.min, max = result.max;
+    for (int i = 0; i < length; i++) {
+        int value = row[i];
+        sum += value;
+        squareSum += (uint64_t)value * value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    result.sum += sum;
+    result.squareSum += squareSum;
+    result.min = min;
+    result.max = max;
+}
+
+template <typename Sample>
+inline void scalarSumAboveSamples(const Sample* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    for (int i = 0; i < length; i++) {
+        if (row[i] > pivot) {
+            count++;
+            sum += row[i];
+        }
+    }
+}
+
+inline void scalarReduceRow(const uint8_t* row, int length, RowReduction& result) {
+    scalarReduceSamples(row, length, result);
+}
+inline void scalarSumAbove(const uint8_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    scalarSumAboveSamples(row, length, pivot, count, sum);
+}
+inline void scalarReduceRow16(const uint16_t* row, int length, RowReduction& result) {
+    scalarReduceSamples(row, length, result);
+}
+inline void scalarSumAbove16(const uint16_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    scalarSumAboveSamples(row, length, pivot, count, sum);
+}
+
+inline void scalarInterleaveBGR(const uint8_t* red, const uint8_t* green, const uint8_t* blue, int length, uint8_t* bgr) {
+    for (int i = 0; i < length; i++) {
+        bgr[3 * i] = blue[i];
+        bgr[3 * i + 1] = green[i];
+        bgr[3 * i + 2] = red[i];
+    }
+}
+
+#ifdef ROWKERNELS_X86
+// Squares are gathered in 32-bit lanes, which are widened before this many vectors can overflow them
+#define ROWKERNELS_SQUARE_FLUSH 4096
+
+/* SSE2 */
+__attribute__((target("sse2")))
+inline void sse2ReduceRow(const uint8_t* row, int length, RowReduction& result) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, squareSum = zero;
+    __m128i minimum = _mm_set1_epi8((char)0xFF), maximum = zero;
+    int i = 0;
+    while (i + 16 <= length) {
+        __m128i squares = zero;
+        int flushEnd = std::min(length - 15, i + 16 * ROWKERNELS_SQUARE_FLUSH);
+        for (; i < flushEnd; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+            __m128i low = _mm_unpacklo_epi8(v, zero), high = _mm_unpackhi_epi8(v, zero);
+            squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+            minimum = _mm_min_epu8(minimum, v);
+            maximum = _mm_max_epu8(maximum, v);
+        }
+        squareSum = _mm_add_epi64(squareSum, _mm_unpacklo_epi32(squares, zero));
+        squareSum = _mm_add_epi64(squareSum, _mm_unpackhi_epi32(squares, zero));
+    }
+
+    alignas(16) uint64_t sums[2], squareSums[2];
+    alignas(16) uint8_t minimums[16], maximums[16];
+    _mm_store_si128((__m128i*)sums, sum);
+    _mm_store_si128((__m128i*)squareSums, squareSum);
+    _mm_store_si128((__m128i*)minimums, minimum);
+    _mm_store_si128((__m128i*)maximums, maximum);
+    if (i > 0) {
+        result.sum += sums[0] + sums[1];
+        result.squareSum += squareSums[0] + squareSums[1];
+        for (int lane = 0; lane < 16; lane++) {
+            result.min = std::min<int>(result.min, minimums[lane]);
+            result.max = std::max<int>(result.max, maximums[lane]);
+        }
+    }
+    scalarReduceRow(row + i, length - i, result);
+}
+
+__attribute__((target("sse2")))
+inline void sse2SumAbove(const uint8_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    if (pivot >= 255) {
+        return;
+    }
+    // Values above the pivot are the ones at least pivot + 1
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(1);
+    const __m128i threshold = _mm_set1_epi8((char)std::max(pivot + 1, 0));
+    __m128i counts = zero, sums = zero;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(v, threshold), v);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_and_si128(v, mask), zero));
+        counts = _mm_add_epi64(counts, _mm_sad_epu8(_mm_and_si128(ones, mask), zero));
+    }
+    alignas(16) uint64_t countLanes[2], sumLanes[2];
+    _mm_store_si128((__m128i*)countLanes, counts);
+    _mm_store_si128((__m128i*)sumLanes, sums);
+    count += countLanes[0] + countLanes[1];
+    sum += sumLanes[0] + sumLanes[1];
+    scalarSumAbove(row + i, length - i, pivot, count, sum);
+}
+
+/* SSSE3 */
+// 16 pixels of each plane are shuffled into the 48 bytes of their BGR pixels
+// Byte j of output vector k is channel (16k + j) % 3 of pixel (16k + j) / 3, the other planes are masked out
+__attribute__((target("ssse3")))
+inline void ssse3InterleaveBGR(const uint8_t* red, const uint8_t* green, const uint8_t* blue, int length, uint8_t* bgr) {
+    alignas(16) static const struct Masks {
+        uint8_t bytes[3][3][16];    // [output vector][B, G, R]
+        Masks() {
+            for (int k = 0; k < 3; k++) {
+                for (int j = 0; j < 16; j++) {
+                    int n = 16 * k + j;
+                    for (int c = 0; c < 3; c++) {
+                        bytes[k][c][j] = n % 3 == c ? (uint8_t)(n / 3) : 0x80;
+                    }
+                }
+            }
+        }
+    } masks;
+
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(blue + i));
+        __m128i g = _mm_loadu_si128((const __m128i*)(green + i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(red + i));
+        for (int k = 0; k < 3; k++) {
+            __m128i out = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(b, _mm_load_si128((const __m128i*)masks.bytes[k][0])),
+                    _mm_shuffle_epi8(g, _mm_load_si128((const __m128i*)masks.bytes[k][1]))),
+                _mm_shuffle_epi8(r, _mm_load_si128((const __m128i*)masks.bytes[k][2])));
+            _mm_storeu_si128((__m128i*)(bgr + 3 * i + 16 * k), out);
+        }
+    }
+    scalarInterleaveBGR(red + i, green + i, blue + i, length - i, bgr + 3 * i);
+}
+
+/* AVX2 */
+__attribute__((target("avx2")))
+inline void avx2ReduceRow(const uint8_t* row, int length, RowReduction& result) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero, squareSum = zero;
+    __m256i minimum = _mm256_set1_epi8((char)0xFF), maximum = zero;
+    int i = 0;
+    while (i + 32 <= length) {
+        __m256i squares = zero;
+        int flushEnd = std::min(length - 31, i + 32 * ROWKERNELS_SQUARE_FLUSH);
+        for (; i < flushEnd; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(row + i));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+            __m256i low = _mm256_unpacklo_epi8(v, zero), high = _mm256_unpackhi_epi8(v, zero);
+            squares = _mm256_add_epi32(squares, _mm256_add_epi32(_mm256_madd_epi16(low, low), _mm256_madd_epi16(high, high)));
+            minimum = _mm256_min_epu8(minimum, v);
+            maximum = _mm256_max_epu8(maximum, v);
+        }
+        squareSum = _mm256_add_epi64(squareSum, _mm256_unpacklo_epi32(squares, zero));
+        squareSum = _mm256_add_epi64(squareSum, _mm256_unpackhi_epi32(squares, zero));
+    }
+
+    alignas(32) uint64_t sums[4], squareSums[4];
+    alignas(32) uint8_t minimums[32], maximums[32];
+    _mm256_store_si256((__m256i*)sums, sum);
+    _mm256_store_si256((__m256i*)squareSums, squareSum);
+    _mm256_store_si256((__m256i*)minimums, minimum);
+    _mm256_store_si256((__m256i*)maximums, maximum);
+    if (i > 0) {
+        result.sum += sums[0] + sums[1] + sums[2] + sums[3];
+        result.squareSum += squareSums[0] + squareSums[1] + squareSums[2] + squareSums[3];
+        for (int lane = 0; lane < 32; lane++) {
+            result.min = std::min<int>(result.min, minimums[lane]);
+            result.max = std::max<int>(result.max, maximums[lane]);
+        }
+    }
+    // Rows shorter than a vector are common on the deep levels
+    sse2ReduceRow(row + i, length - i, result);
+}
+
+__attribute__((target("avx2")))
+inline void avx2SumAbove(const uint8_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    if (pivot >= 255) {
+        return;
+    }
+    const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8(1);
+    const __m256i threshold = _mm256_set1_epi8((char)std::max(pivot + 1, 0));
+    __m256i counts = zero, sums = zero;
+    int i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(row + i));
+        __m256i mask = _mm256_cmpeq_epi8(_mm256_max_epu8(v, threshold), v);
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_and_si256(v, mask), zero));
+        counts = _mm256_add_epi64(counts, _mm256_sad_epu8(_mm256_and_si256(ones, mask), zero));
+    }
+    alignas(32) uint64_t countLanes[4], sumLanes[4];
+    _mm256_store_si256((__m256i*)countLanes, counts);
+    _mm256_store_si256((__m256i*)sumLanes, sums);
+    count += countLanes[0] + countLanes[1] + countLanes[2] + countLanes[3];
+    sum += sumLanes[0] + sumLanes[1] + sumLanes[2] + sumLanes[3];
+    sse2SumAbove(row + i, length - i, pivot, count, sum);
+}
+
+// 16-bit sums are split into the sums of the low and high bytes so _mm256_sad_epu8 still gathers them in 64 bits
+// Squares are up to 32 bits wide and widened to 64 bits right away
+__attribute__((target("avx2")))
+inline void avx2ReduceRow16(const uint16_t* row, int length, RowReduction& result) {
+    const __m256i zero = _mm256_setzero_si256(), lowBytes = _mm256_set1_epi16(0xFF);
+    __m256i sumLow = zero, sumHigh = zero, squareSum = zero;
+    __m256i minimum = _mm256_set1_epi16((short)0xFFFF), maximum = zero;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(row + i));
+        sumLow = _mm256_add_epi64(sumLow, _mm256_sad_epu8(_mm256_and_si256(v, lowBytes), zero));
+        sumHigh = _mm256_add_epi64(sumHigh, _mm256_sad_epu8(_mm256_srli_epi16(v, 8), zero));
+        __m256i squareLow = _mm256_mullo_epi16(v, v), squareHigh = _mm256_mulhi_epu16(v, v);
+        __m256i squares0 = _mm256_unpacklo_epi16(squareLow, squareHigh), squares1 = _mm256_unpackhi_epi16(squareLow, squareHigh);
+        squareSum = _mm256_add_epi64(squareSum, _mm256_add_epi64(_mm256_unpacklo_epi32(squares0, zero), _mm256_unpackhi_epi32(squares0, zero)));
+        squareSum = _mm256_add_epi64(squareSum, _mm256_add_epi64(_mm256_unpacklo_epi32(squares1, zero), _mm256_unpackhi_epi32(squares1, zero)));
+        minimum = _mm256_min_epu16(minimum, v);
+        maximum = _mm256_max_epu16(maximum, v);
+    }
+
+    alignas(32) uint64_t lows[4], highs[4], squareSums[4];
+    alignas(32) uint16_t minimums[16], maximums[16];
+    _mm256_store_si256((__m256i*)lows, sumLow);
+    _mm256_store_si256((__m256i*)highs, sumHigh);
+    _mm256_store_si256((__m256i*)squareSums, squareSum);
+    _mm256_store_si256((__m256i*)minimums, minimum);
+    _mm256_store_si256((__m256i*)maximums, maximum);
+    if (i > 0) {
+        result.sum += lows[0] + lows[1] + lows[2] + lows[3] + ((highs[0] + highs[1] + highs[2] + highs[3]) << 8);
+        result.squareSum += squareSums[0] + squareSums[1] + squareSums[2] + squareSums[3];
+        for (int lane = 0; lane < 16; lane++) {
+            result.min = std::min<int>(result.min, minimums[lane]);
+            result.max = std::max<int>(result.max, maximums[lane]);
+        }
+    }
+    scalarReduceRow16(row + i, length - i, result);
+}
+
+__attribute__((target("avx2")))
+inline void avx2SumAbove16(const uint16_t* row, int length, int pivot, uint64_t& count, uint64_t& sum) {
+    if (pivot >= 65535) {
+        return;
+    }
+    const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi16(1), lowBytes = _mm256_set1_epi16(0xFF);
+    const __m256i threshold = _mm256_set1_epi16((short)std::max(pivot + 1, 0));
+    __m256i counts = zero, sumLow = zero, sumHigh = zero;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(row + i));
+        __m256i mask = _mm256_cmpeq_epi16(_mm256_max_epu16(v, threshold), v);
+        __m256i above = _mm256_and_si256(v, mask);
+        sumLow = _mm256_add_epi64(sumLow, _mm256_sad_epu8(_mm256_and_si256(above, lowBytes), zero));
+        sumHigh = _mm256_add_epi64(sumHigh, _mm256_sad_epu8(_mm256_srli_epi16(above, 8), zero));
+        counts = _mm256_add_epi64(counts, _mm256_sad_epu8(_mm256_and_si256(ones, mask), zero));
+    }
+    alignas(32) uint64_t countLanes[4], lows[4], highs[4];
+    _mm256_store_si256((__m256i*)countLanes, counts);
+    _mm256_store_si256((__m256i*)lows, sumLow);
+    _mm256_store_si256((__m256i*)highs, sumHigh);
+    count += countLanes[0] + countLanes[1] + countLanes[2] + countLanes[3];
+    sum += lows[0] + lows[1] + lows[2] + lows[3] + ((highs[0] + highs[1] + highs[2] + highs[3]) << 8);
+    scalarSumAbove16(row + i, length - i, pivot, count, sum);
+}
+#endif
+
+inline const RowKernels& RowKernels::active() {
+    static const RowKernels scalar = { "scalar", scalarReduceRow, scalarSumAbove, scalarInterleaveBGR,
+        scalarReduceRow16, scalarSumAbove16 };
+#ifdef ROWKERNELS_X86
+    // Every CPU with AVX2 has SSSE3. SSE2 has no unsigned 16-bit min and max, 16-bit rows stay scalar there
+    static const RowKernels sse2 = { "sse2", sse2ReduceRow, sse2SumAbove, scalarInterleaveBGR,
+        scalarReduceRow16, scalarSumAbove16 };
+    static const RowKernels avx2 = { "avx2", avx2ReduceRow, avx2SumAbove, ssse3InterleaveBGR,
+        avx2ReduceRow16, avx2SumAbove16 };
+    static const RowKernels& selected = [&]() -> const RowKernels& {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return avx2;
+        if (__builtin_cpu_supports("sse2")) return sse2;
+        return scalar;
+    }();
+    return selected;
+#else
+    return scalar;
+#endif
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include "taskpool.hpp"
+
+TaskPool::TaskPool(int threadCount)
+    : threadCount(threadCount > 0 ? threadCount : (int)std::max(1u, std::thread::hardware_concurrency())),
+    pending(0), queued(0), failed(false) {
+    for (int i = 0; i < this->threadCount; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+void TaskPool::run(Task task) {
+    error = nullptr;
+    failed = false;
+    pending = 0;
+    spawn(0, std::move(task));
+
+    // The calling thread is worker 0, the threads only live for the run
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back([this, i] { work(i); });
+    }
+    work(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskPool::spawn(int worker, Task task) {
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+        workers[worker]->tasks.push_back(std::move(task));
+    }
+    queued++;
+    {
+        // Taken so that a worker cannot miss the signal between checking the queues and waiting
+        std::lock_guard<std::mutex> lock(idleMutex);
+    }
+    idle.notify_one();
+}
+
+bool TaskPool::take(int worker, Task& task) {
+    for (int i = 0; i < threadCount; i++) {
+        // Own queue first, newest task. Then the other queues, oldest task
+        int victim = (worker + i) % threadCount;
+        std::lock_guard<std::mutex> lock(workers[victim]->mutex);
+        std::deque<Task>& tasks = workers[victim]->tasks;
+        if (tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::work(int worker) {
+    Task task;
+    while (true) {
+        if (take(worker, task)) {
+            if (!failed) {
+                try {
+                    task(worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed = true;
+                }
+            }
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idle.wait(lock, [this] { return pending == 0 || queued > 0; });
+        if (pending == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef TASKPOOL_HPP
+#define TASKPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool of threads running a task and every task it spawns
+// Each worker keeps its own queue of tasks: spawned tasks are pushed to the back of the spawning worker's queue
+// and taken back from the back, newest first, so a worker goes on with the data it just touched. A worker whose
+// queue is empty steals the oldest task of another worker, which is the largest one when tasks split their work
+class TaskPool {
+public:
+    // Task, given the index of the worker running it
+    typedef std::function<void(int)> Task;
+
+    // Workers including the calling thread of run. 0 for one per hardware thread
+    TaskPool(int threadCount = 0);
+
+    int getThreadCount() const { return threadCount; }
+
+    // Run a task on the calling thread and the spawned tasks on every worker, returns once all of them are done
+    // The first exception thrown by a task is rethrown once the tasks already running are done, the tasks
+    // that were not started yet are dropped
+    void run(Task task);
+
+    // Queue a task from a task running on the given worker
+    void spawn(int worker, Task task);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    int threadCount;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::atomic<int64_t> pending;   // Tasks spawned and not done yet, the run is over at 0
+    std::atomic<int64_t> queued;    // Tasks waiting in the queues
+    std::mutex idleMutex;
+    std::condition_variable idle;   // Signaled when a task is queued or the run is over
+
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed;
+
+    // Take a task from the worker's queue, or steal one from the others
+    bool take(int worker, Task& task);
+
+    // Run tasks until the run is over
+    void work(int worker);
+};
+
+#endif
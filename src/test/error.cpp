@@ -4,7 +4,10 @@
 // ./src/test/error
 
 #include "../error.hpp"
+#include <cmath>
 #include <iostream>
+#include <iomanip>
+#include <string>
 #include <vector>
 
 int main() {
@@ -111,5 +114,128 @@ int main() {
     entropy = ErrorMetrics::calculateChannelError(ErrorMethod::ENTROPY, data6.begin(), data6.end());
     std::cout << "Entropy 6: " << entropy << std::endl;
 
-    return 0;
+    // The results below are checked against the ones above, a failed check is reported and fails the test
+    int failures = 0;
+    auto check = [&failures](bool passed, const std::string& what) {
+        if (!passed) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    };
+    auto near = [](double a, double b) { return std::abs(a - b) <= 1e-9; };
+
+    // Entropy from histogram, should match the entropy above
+    std::vector<std::vector<int>*> allData = { &data1, &data2, &data3, &data4, &data5, &data6 };
+    for (size_t i = 0; i < allData.size(); i++) {
+        ChannelHistogram histogram;
+        for (const auto& val : *allData[i]) histogram.add(val);
+        entropy = ErrorMetrics::calculateEntropy(histogram);
+        std::cout << "Entropy from histogram " << i + 1 << ": " << entropy << std::endl;
+        mad = ErrorMetrics::calculateMeanAbsoluteDeviation(histogram);
+        std::cout << "Mean Absolute Deviation from histogram " << i + 1 << ": " << mad << std::endl;
+
+        const std::vector<int>& data = *allData[i];
+        check(near(entropy, ErrorMetrics::calculateChannelError(ErrorMethod::ENTROPY, data.begin(), data.end())),
+            "entropy from histogram " + std::to_string(i + 1));
+        check(near(mad, ErrorMetrics::calculateChannelError(ErrorMethod::MEAN_ABSOLUTE_DEVIATION, data.begin(), data.end())),
+            "mean absolute deviation from histogram " + std::to_string(i + 1));
+    }
+
+
+    // Fused block statistics, each data is used as a single row block on all three channels
+    for (size_t i = 0; i < allData.size() - 1; i++) {
+        const std::vector<int>& data = *allData[i];
+        auto rowOf = [&data](int, int) { return data.data(); };
+        BlockStatistics sums = ErrorMetrics::calculateBlockStatistics(rowOf, 0, 0, 0, (int)data.size() - 1);
+        double means[3];
+        for (int channel = 0; channel < 3; channel++) means[channel] = (double)sums.moments[channel].sum / data.size();
+        BlockStatistics statistics = ErrorMetrics::calculateBlockStatistics(rowOf, 0, 0, 0, (int)data.size() - 1, means);
+        std::cout << "Block statistics " << i + 1 << ": "
+            << "variance " << ErrorMetrics::calculateChannelError(ErrorMethod::VARIANCE, statistics, 0) << ", "
+            << "mad " << ErrorMetrics::calculateChannelError(ErrorMethod::MEAN_ABSOLUTE_DEVIATION, statistics, 1) << ", "
+            << "max difference " << ErrorMetrics::calculateChannelError(ErrorMethod::MAX_PIXEL_DIFFERENCE, statistics, 2) << std::endl;
+
+        for (ErrorMethod method : { ErrorMethod::VARIANCE, ErrorMethod::MEAN_ABSOLUTE_DEVIATION, ErrorMethod::MAX_PIXEL_DIFFERENCE }) {
+            double expected = ErrorMetrics::calculateChannelError(method, data.begin(), data.end());
+            for (int channel = 0; channel < 3; channel++) {
+                check(near(ErrorMetrics::calculateChannelError(method, statistics, channel), expected),
+                    "block statistics " + std::to_string(i + 1) + " method " + std::to_string(method) + " channel " + std::to_string(channel));
+            }
+        }
+    }
+
+    // Row kernels, every implementation should give the same result
+    std::vector<uint8_t> row(1000);
+    for (size_t i = 0; i < row.size(); i++) row[i] = (uint8_t)((i * 37 + 11) % 251);
+    std::vector<uint16_t> row16(1000);
+    for (size_t i = 0; i < row16.size(); i++) row16[i] = (uint16_t)((i * 40503 + 11) % 65521);
+    std::vector<RowKernels> implementations = { { "scalar", scalarReduceRow, scalarSumAbove, scalarInterleaveBGR,
+        scalarReduceRow16, scalarSumAbove16 } };
+#ifdef ROWKERNELS_X86
+    implementations.push_back({ "sse2", sse2ReduceRow, sse2SumAbove, scalarInterleaveBGR, scalarReduceRow16, scalarSumAbove16 });
+    if (__builtin_cpu_supports("avx2")) implementations.push_back({ "avx2", avx2ReduceRow, avx2SumAbove, ssse3InterleaveBGR,
+        avx2ReduceRow16, avx2SumAbove16 });
+#endif
+    // Reduction of the samples of a row from the fourth one, computed directly
+    auto checkReduction = [&check](const auto& samples, int pivot, const RowReduction& reduction, uint64_t countAbove,
+        uint64_t sumAbove, const std::string& what) {
+        RowReduction expected;
+        uint64_t expectedCount = 0, expectedSum = 0;
+        for (size_t i = 3; i < samples.size(); i++) {
+            int value = samples[i];
+            expected.sum += value;
+            expected.squareSum += (uint64_t)value * value;
+            expected.min = std::min(expected.min, value);
+            expected.max = std::max(expected.max, value);
+            if (value > pivot) {
+                expectedCount++;
+                expectedSum += value;
+            }
+        }
+        check(reduction.sum == expected.sum && reduction.squareSum == expected.squareSum && reduction.min == expected.min
+            && reduction.max == expected.max && countAbove == expectedCount && sumAbove == expectedSum, what);
+    };
+    uint64_t expectedChecksum = 0;
+    for (size_t i = 0; i < row.size() - 7; i++) {
+        expectedChecksum += (3 * i + 1) * row[7 + i] + (3 * i + 2) * row[4 + i] + (3 * i + 3) * row[1 + i];
+    }
+
+    std::cout << "Active row kernels: " << RowKernels::active().name << std::endl;
+    for (const RowKernels& kernels : implementations) {
+        RowReduction reduction;
+        uint64_t countAbove = 0, sumAbove = 0;
+        kernels.reduce(row.data() + 3, (int)row.size() - 3, reduction);
+        kernels.sumAbove(row.data() + 3, (int)row.size() - 3, 100, countAbove, sumAbove);
+        std::cout << "Row kernels " << kernels.name << ": sum " << reduction.sum << ", square sum " << reduction.squareSum
+            << ", min " << reduction.min << ", max " << reduction.max
+            << ", above 100 " << countAbove << " summing to " << sumAbove << std::endl;
+        checkReduction(row, 100, reduction, countAbove, sumAbove, std::string("row kernels ") + kernels.name);
+
+        RowReduction reduction16;
+        uint64_t countAbove16 = 0, sumAbove16 = 0;
+        kernels.reduce16(row16.data() + 3, (int)row16.size() - 3, reduction16);
+        kernels.sumAbove16(row16.data() + 3, (int)row16.size() - 3, 30000, countAbove16, sumAbove16);
+        std::cout << "Row kernels " << kernels.name << " 16-bit: sum " << reduction16.sum << ", square sum " << reduction16.squareSum
+            << ", min " << reduction16.min << ", max " << reduction16.max
+            << ", above 30000 " << countAbove16 << " summing to " << sumAbove16 << std::endl;
+        checkReduction(row16, 30000, reduction16, countAbove16, sumAbove16, std::string("row kernels ") + kernels.name + " 16-bit");
+
+        // The three planes are offsets into the same row, the checksum weighs each byte by its position
+        std::vector<uint8_t> bgr(3 * (row.size() - 7));
+        kernels.interleaveBGR(row.data() + 1, row.data() + 4, row.data() + 7, (int)row.size() - 7, bgr.data());
+        uint64_t checksum = 0;
+        for (size_t i = 0; i < bgr.size(); i++) checksum += (i + 1) * bgr[i];
+        std::cout << "Row kernels " << kernels.name << ": BGR interleave checksum " << checksum
+            << ", first pixel " << (int)bgr[0] << " " << (int)bgr[1] << " " << (int)bgr[2] << std::endl;
+        check(checksum == expectedChecksum, std::string("row kernels ") + kernels.name + " BGR interleave");
+    }
+
+    // Exact integer variance, a large block alternating 254 and 255 should be exactly 0.25
+    std::vector<uint8_t> large(1 << 24);
+    for (size_t i = 0; i < large.size(); i++) large[i] = (uint8_t)(254 + i % 2);
+    variance = ErrorMetrics::calculateChannelError(ErrorMethod::VARIANCE, large.begin(), large.end());
+    std::cout << "Variance of large block: " << std::setprecision(17) << variance << std::endl;
+    check(variance == 0.25, "variance of large block");
+
+    return failures == 0 ? 0 : 1;
 }
\ No newline at end of file